@@ -1,289 +1,5583 @@
-/*
- * shredder.c
- * Simple secure-delete utility for Linux
- *
- * Compile:
- *   gcc -O2 -std=c11 -Wall -Wextra -o shredder shredder.c
- *
- * Usage:
- *   ./shredder [-n passes] [-z] [-v] file...
- *     -n passes   Number of random overwrite passes (default 3)
- *     -z          Add a final pass of zeros after random passes
- *     -v          Verbose output
- *
- * Limitations: See the program header notes about SSDs, COW filesystems, snapshots, etc.
- */
-
-#define _GNU_SOURCE
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <unistd.h>
-#include <sys/random.h>
-#include <errno.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <stdint.h>
-#include <inttypes.h>
-#include <time.h>
-#include <libgen.h>
-#include <stdbool.h>
-
-static size_t CHUNK = 1024 * 1024; /* 1 MiB buffer */
-
-static void *alloc_buf(size_t size) {
-    void *p = malloc(size);
-    if (!p) {
-        fprintf(stderr, "malloc(%zu) failed\n", size);
-        exit(2);
-    }
-    return p;
-}
-
-static ssize_t fill_random(void *buf, size_t len) {
-    /* Try getrandom first */
-    ssize_t got = 0;
-#if defined(SYS_getrandom) || defined(GRND_NONBLOCK)
-    /* use getrandom syscall via wrapper */
-    ssize_t r = 0;
-    size_t left = len;
-    unsigned char *p = buf;
-    while (left) {
-        r = getrandom(p, left, 0);
-        if (r < 0) {
-            if (errno == EINTR) continue;
-            got = -1;
-            break;
-        }
-        left -= r;
-        p += r;
-    }
-    if (left == 0) return (ssize_t)len;
-    /* otherwise fall through to /dev/urandom */
-#endif
-
-    int fd = open("/dev/urandom", O_RDONLY);
-    if (fd < 0) return -1;
-    ssize_t total = 0;
-    while (total < (ssize_t)len) {
-        ssize_t r = read(fd, (unsigned char*)buf + total, len - total);
-        if (r < 0) {
-            if (errno == EINTR) continue;
-            total = -1;
-            break;
-        }
-        if (r == 0) break;
-        total += r;
-    }
-    close(fd);
-    return total;
-}
-
-static int sync_and_check(int fd) {
-    /* Try fdatasync then fsync as a fallback */
-    if (fdatasync(fd) == 0) return 0;
-    if (fsync(fd) == 0) return 0;
-    return -1;
-}
-
-/* generate random ascii hex filename in same directory */
-static char *random_filename_in_dir(const char *orig_path) {
-    char *path = strdup(orig_path);
-    if (!path) return NULL;
-    char *dir = dirname(path); /* NOTE: dirname may modify input */
-    size_t name_len = 16; /* 16 hex chars */
-    char rndbuf[16];
-    if (fill_random(rndbuf, sizeof(rndbuf)) != (ssize_t)sizeof(rndbuf)) {
-        free(path);
-        return NULL;
-    }
-    char name[32+1];
-    for (int i = 0; i < (int)name_len/2; ++i) {
-        sprintf(name + i*2, "%02x", (unsigned char)rndbuf[i]);
-    }
-    name[name_len] = '\0';
-    size_t outlen = strlen(dir) + 1 + strlen(name) + 1;
-    char *out = malloc(outlen);
-    if (!out) {
-        free(path);
-        return NULL;
-    }
-    snprintf(out, outlen, "%s/%s", dir, name);
-    free(path);
-    return out;
-}
-
-static int overwrite_file(const char *path, int passes, bool final_zero, bool verbose) {
-    struct stat st;
-    if (stat(path, &st) != 0) {
-        if (verbose) perror("stat");
-        return -1;
-    }
-    if (!S_ISREG(st.st_mode)) {
-        if (verbose) fprintf(stderr, "skipping non-regular file: %s\n", path);
-        return -1;
-    }
-
-    off_t size = st.st_size;
-    int fd = open(path, O_WRONLY);
-    if (fd < 0) {
-        if (verbose) perror("open");
-        return -1;
-    }
-
-    /* Use a moderate chunk buffer */
-    size_t bufsize = (CHUNK < (size_t)size) ? CHUNK : (size_t)size ? (size_t)size : CHUNK;
-    void *buf = alloc_buf(bufsize);
-
-    for (int pass = 1; pass <= passes; ++pass) {
-        if (verbose) fprintf(stderr, "Pass %d/%d (random) for %s\n", pass, passes, path);
-        off_t written_total = 0;
-        if (lseek(fd, 0, SEEK_SET) == (off_t)-1) {
-            if (verbose) perror("lseek");
-            free(buf);
-            close(fd);
-            return -1;
-        }
-        while (written_total < size) {
-            size_t towrite = bufsize;
-            if ((off_t)towrite > size - written_total) towrite = (size_t)(size - written_total);
-            if (fill_random(buf, towrite) != (ssize_t)towrite) {
-                if (verbose) fprintf(stderr, "random generation failed\n");
-                free(buf);
-                close(fd);
-                return -1;
-            }
-            ssize_t w = write(fd, buf, towrite);
-            if (w < 0) {
-                if (errno == EINTR) continue;
-                if (verbose) perror("write");
-                free(buf);
-                close(fd);
-                return -1;
-            }
-            written_total += w;
-        }
-        /* Ensure writes are flushed */
-        if (sync_and_check(fd) != 0) {
-            if (verbose) perror("sync");
-            /* continue anyway, but warn */
-        }
-    }
-
-    if (final_zero) {
-        if (verbose) fprintf(stderr, "Final zero pass for %s\n", path);
-        off_t written_total = 0;
-        if (lseek(fd, 0, SEEK_SET) == (off_t)-1) {
-            if (verbose) perror("lseek");
-            free(buf);
-            close(fd);
-            return -1;
-        }
-        memset(buf, 0, bufsize);
-        while (written_total < size) {
-            size_t towrite = bufsize;
-            if ((off_t)towrite > size - written_total) towrite = (size_t)(size - written_total);
-            ssize_t w = write(fd, buf, towrite);
-            if (w < 0) {
-                if (errno == EINTR) continue;
-                if (verbose) perror("write");
-                free(buf);
-                close(fd);
-                return -1;
-            }
-            written_total += w;
-        }
-        if (sync_and_check(fd) != 0) {
-            if (verbose) perror("sync");
-        }
-    }
-
-    /* Optionally try to discard physical blocks? Not reliable and may not be desired. */
-
-    free(buf);
-    if (close(fd) != 0 && verbose) perror("close");
-    return 0;
-}
-
-int main(int argc, char **argv) {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s [-n passes] [-z] [-v] file...\n", argv[0]);
-        return 1;
-    }
-
-    int passes = 3;
-    bool final_zero = false;
-    bool verbose = false;
-    int opt;
-    while ((opt = getopt(argc, argv, "n:zv")) != -1) {
-        switch (opt) {
-            case 'n': passes = atoi(optarg); if (passes < 1) passes = 1; break;
-            case 'z': final_zero = true; break;
-            case 'v': verbose = true; break;
-            default:
-                fprintf(stderr, "Usage: %s [-n passes] [-z] [-v] file...\n", argv[0]);
-                return 1;
-        }
-    }
-
-    if (optind >= argc) {
-        fprintf(stderr, "No files specified\n");
-        return 1;
-    }
-
-    /* Seed for fallback name changes */
-    srand((unsigned)time(NULL) ^ (unsigned)getpid());
-
-    int exit_status = 0;
-    for (int i = optind; i < argc; ++i) {
-        const char *path = argv[i];
-        if (verbose) fprintf(stderr, "Processing %s\n", path);
-
-        if (overwrite_file(path, passes, final_zero, verbose) != 0) {
-            fprintf(stderr, "Failed to securely overwrite %s\n", path);
-            exit_status = 2;
-            continue;
-        }
-
-        /* rename file to random name to hide original name */
-        char *newname = random_filename_in_dir(path);
-        if (newname) {
-            if (rename(path, newname) != 0) {
-                if (verbose) perror("rename");
-                free(newname);
-            } else {
-                if (verbose) fprintf(stderr, "Renamed %s -> %s\n", path, newname);
-                /* Optionally try to fsync the directory to persist rename */
-                /* Open directory and fsync it */
-                char *tmp = strdup(newname);
-                char *dir = dirname(tmp);
-                int dfd = open(dir, O_DIRECTORY | O_RDONLY);
-                if (dfd >= 0) {
-                    if (fsync(dfd) != 0 && verbose) perror("fsync(dir)");
-                    close(dfd);
-                }
-                free(tmp);
-                /* unlink new name below */
-                if (unlink(newname) != 0) {
-                    if (verbose) perror("unlink");
-                    exit_status = 2;
-                } else {
-                    if (verbose) fprintf(stderr, "Unlinked %s\n", newname);
-                }
-                free(newname);
-                continue;
-            }
-        }
-
-        /* If rename failed or not used, unlink original path */
-        if (unlink(path) != 0) {
-            if (verbose) perror("unlink");
-            exit_status = 2;
-        } else {
-            if (verbose) fprintf(stderr, "Unlinked %s\n", path);
-        }
-    }
-
-    return exit_status;
-}
+/*
+ * shredder.c
+ * Simple secure-delete utility for Linux
+ *
+ * Compile:
+ *   gcc -O2 -std=c11 -Wall -Wextra -pthread -o shredder shredder.c
+ * or as a library for in-process use (API in shredder.h), without main():
+ *   gcc -O2 -std=c11 -Wall -Wextra -pthread -fPIC -DSHREDDER_LIBRARY -c shredder.c -o libshredder.o
+ *
+ * Usage:
+ *   ./shredder [-n passes] [-z] [-v] [-R rng] [-j jobs] [-e engine] [-Q depth] [-D] [-b size] [-P buffers] [-S policy] [-r] [-H] [-W writers] [-p] [--files-from list] [-0] [--journal file] [--verify] [--max-rate rate] [--adaptive] [--idle] [--scheme S] [--stats json|csv] [--cow policy] [--discard[=secure]] [--numa] [--schedule S] file...
+ *     -n passes   Number of random overwrite passes (default 3)
+ *     -z          Add a final pass of zeros after random passes; offloaded to
+ *                 fallocate(ZERO_RANGE) or BLKZEROOUT unless --no-zero-offload
+ *     -v          Verbose output
+ *     -R rng      Random source: "kernel" (getrandom per chunk, default)
+ *                 or "chacha" (seed once per pass, expand in userspace)
+ *     -j jobs     Shred up to this many files concurrently (0 = one per CPU)
+ *     -e engine   Overwrite engine: "write" (blocking pwrite, default),
+ *                 "uring" (io_uring with queued writes and linked fsync) or
+ *                 "mmap" (generate into a shared mapping, 64M windows; files only)
+ *     -Q depth    io_uring writes kept in flight per file (default 16)
+ *     -D          O_DIRECT writes with block-aligned buffers (bypass page cache)
+ *     -b size     Write size, e.g. 512K or 4M (default 1M); "auto" picks a
+ *                 stripe-aligned size from st_blksize and the block queue
+ *     -P buffers  write engine: generate random data in a separate thread,
+ *                 this many buffers ahead of the writer (2..64)
+ *     -S policy   When to fdatasync: "pass" (after every pass, default), N
+ *                 (every N passes) or "final" (last pass only); passes that
+ *                 skip it stream writeback with sync_file_range() instead
+ *     -r          Recurse into directories, shredding every regular file
+ *                 and removing the emptied directories
+ *     -H          Sparse files: overwrite only allocated extents (SEEK_DATA/
+ *                 SEEK_HOLE) and punch out the holes afterwards
+ *     -W writers  Block devices: split the device into this many stripes,
+ *                 each written by its own thread (0 = auto, default)
+ *     -p          Progress, rate and ETA per file and overall on stderr every
+ *                 second; --progress-json prints the same as JSON lines on stdout
+ *     --files-from FILE
+ *                 Also shred the paths listed in FILE ("-" = stdin), one per line
+ *     -0          The --files-from list is NUL-separated (find -print0); with
+ *                 no files given, read it from stdin
+ *
+ *     --journal FILE
+ *                 Checkpoint files of --journal-interval bytes or more (default
+ *                 1G) after every successful sync; run again with the same FILE
+ *                 after a crash or SIGINT/SIGTERM to resume where it stopped
+ *
+ *     --verify    Read the last pass back with O_DIRECT and compare it, overlapped
+ *                 with the next file; a final random pass uses a ChaCha20
+ *                 keystream so it can be regenerated (-R kernel included)
+ *
+ *     --max-rate RATE
+ *                 Cap the total write rate of all workers, e.g. 200M (per second)
+ *     --adaptive  Also back off while per-write latency shows the device is
+ *                 congested by other I/O
+ *     --idle      Idle I/O priority class (ioprio_set), honoured by BFQ and
+ *                 mq-deadline for the I/O this process submits
+ *
+ *     --scheme S  Pass schedule instead of -n: "dod" (00, ff, random), "dod7",
+ *                 "gutmann" (35 passes) or a list such as "55,aa,random,924924"
+ *                 of random and 1-3 byte hex patterns; -z still appends zeros
+ *     --stats json|csv
+ *                 At exit, print p50/p99/max latency and total time of each
+ *                 phase (open, rng, write, sync, rename, unlink, ...) and the
+ *                 per-file throughput on stdout
+ *     --cow warn|skip|force
+ *                 Files on copy-on-write filesystems (btrfs, zfs, bcachefs,
+ *                 nilfs2), where overwrites go to new blocks: overwrite with a
+ *                 warning (default), skip as failed, or overwrite silently.
+ *                 Extents shared with other files (reflinks) are never written
+ *     --discard[=secure]
+ *                 After the last pass, punch the file's blocks out (passed on to
+ *                 the SSD as TRIM) or BLKDISCARD a block device, with =secure
+ *                 BLKSECDISCARD where the device has it
+ *     --numa      With -j on a multi-socket host: pin workers to NUMA nodes,
+ *                 keep their buffers node-local and give each file to a
+ *                 worker on the node nearest its device
+ *     --schedule fifo|size
+ *                 With -j, "size" starts the largest files first, 256M and
+ *                 up on dedicated workers, instead of in argument order
+ *
+ *   ./shredder --bench dir [--bench-size 4K,64M] [--bench-runs N] [options]
+ *                 Time every engine on scratch files in dir, JSON lines on stdout
+ *   ./shredder --free-space dir [--reserve size] [options]
+ *                 Overwrite the free space of dir's filesystem with -j filler
+ *                 files, stopping size (default 1%) short of full
+ *   ./shredder --daemon socket [--daemon-any-user] [options]
+ *                 Keep the workers running and shred the paths and file
+ *                 descriptors clients send over the Unix socket ("@name" =
+ *                 abstract), answering each when it is done. Clients must
+ *                 run as the daemon's user unless --daemon-any-user is given
+ *
+ * Limitations: See the program header notes about SSDs, COW filesystems, snapshots, etc.
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <sys/statvfs.h>
+#include <sys/vfs.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <stddef.h>
+#include <signal.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include <dirent.h>
+#include <limits.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+#include "shredder.h"
+
+/* io_uring support needs headers new enough for RENAMEAT (5.11+) */
+#if defined(IORING_FEAT_NATIVE_WORKERS) && defined(__NR_io_uring_setup)
+#define HAVE_IO_URING 1
+#endif
+
+static size_t CHUNK = 1024 * 1024; /* 1 MiB default buffer, see -b */
+
+enum rng_mode {
+    RNG_KERNEL, /* getrandom()/urandom for every chunk */
+    RNG_CHACHA, /* ChaCha20 keystream seeded once per pass */
+};
+
+enum shred_engine {
+    ENGINE_WRITE, /* blocking pwrite() loop */
+    ENGINE_URING, /* queued io_uring writes, linked fsync */
+    ENGINE_MMAP,  /* generate straight into a shared mapping of the file */
+};
+
+enum cow_policy {
+    COW_WARN,  /* overwrite files on copy-on-write filesystems anyway, with a warning */
+    COW_SKIP,  /* leave them alone and report them as failed */
+    COW_FORCE, /* overwrite them without a word */
+};
+
+enum discard_mode {
+    DISCARD_NONE,
+    DISCARD_ON,     /* punch the file's blocks / BLKDISCARD the device after the last pass */
+    DISCARD_SECURE, /* block devices: BLKSECDISCARD where supported */
+};
+
+struct shred_opts {
+    int passes;
+    bool final_zero;
+    bool verbose;
+    enum rng_mode rng;
+    int jobs;           /* concurrent files (-j) */
+    enum shred_engine engine;
+    unsigned queue_depth; /* io_uring writes in flight per file */
+    bool direct;        /* O_DIRECT, bypass the page cache */
+    size_t chunk;       /* write size (-b); 0 = pick per file from the device */
+    unsigned pipeline;  /* write() engine: ring buffers filled ahead of the writer (-P) */
+    int sync_every;     /* fdatasync every N passes (-S); 0 = last pass only */
+    bool recursive;     /* -r: walk directories */
+    bool sparse;        /* only overwrite allocated extents */
+    bool zero_offload;  /* zero pass via fallocate/BLKZEROOUT when possible */
+    unsigned stripes;   /* -W: writer threads per block device, 0 = auto */
+    bool verify;        /* read the last pass back with O_DIRECT and compare */
+    const struct pass_spec *scheme; /* --scheme passes replacing -n, or NULL */
+    int scheme_len;
+    unsigned pattern_max; /* longest pattern in the scheme; 0 = no pattern passes */
+    enum cow_policy cow;
+    enum discard_mode discard;
+    shredder_progress_fn progress; /* library: called per chunk written, or NULL */
+    void *progress_arg;
+    FILE *log;          /* library: where messages go; NULL = stderr */
+};
+
+enum pass_kind {
+    PASS_RANDOM,
+    PASS_ZERO,                  /* -z: may be offloaded, see zero_offload() */
+    PASS_PATTERN,               /* fixed bytes, always written (e.g. DoD 0x00/0xFF) */
+};
+
+/*
+ * --scheme: the pass schedule. Without one it is -n random passes; -z appends
+ * a zero pass either way. Pattern passes repeat up to PATTERN_MAX bytes from
+ * file offset 0, so a pattern stays in phase across chunks and extents.
+ */
+#define PATTERN_MAX 3
+#define SCHEME_MAX 64
+
+struct pass_spec {
+    enum pass_kind kind;
+    unsigned char pattern[PATTERN_MAX];
+    unsigned char len;          /* PASS_PATTERN: bytes in pattern */
+};
+
+static const struct {
+    const char *name;
+    const char *passes;
+} schemes[] = {
+    /* DoD 5220.22-M: a character, its complement, random */
+    { "dod", "00,ff,random" },
+    /* DoD 5220.22-M ECE: the above, a random pass, then the above again */
+    { "dod7", "00,ff,random,random,00,ff,random" },
+    /* Gutmann 1996, pattern passes 5-31 in table order */
+    { "gutmann", "random,random,random,random,55,aa,924924,492492,249249,00,11,22,33,44,55,66,77,88,99,"
+                 "aa,bb,cc,dd,ee,ff,924924,492492,249249,6db6db,b6db6d,db6db6,random,random,random,random" },
+};
+
+/* total passes, the -z zero pass included */
+static int pass_count(const struct shred_opts *o) {
+    return (o->scheme ? o->scheme_len : o->passes) + (o->final_zero ? 1 : 0);
+}
+
+/* pass n of the schedule, 1-based */
+static struct pass_spec pass_at(const struct shred_opts *o, int n) {
+    int base = o->scheme ? o->scheme_len : o->passes;
+    if (n > base) return (struct pass_spec){ .kind = PASS_ZERO };
+    if (o->scheme) return o->scheme[n - 1];
+    return (struct pass_spec){ .kind = PASS_RANDOM };
+}
+
+/* "dod", "gutmann" or a list such as "00,ff,random,924924"; returns the pass count or -1 */
+static int parse_scheme(const char *arg, struct pass_spec out[SCHEME_MAX], unsigned *pattern_max) {
+    for (size_t i = 0; i < sizeof(schemes) / sizeof(schemes[0]); ++i)
+        if (strcmp(arg, schemes[i].name) == 0) arg = schemes[i].passes;
+    int n = 0;
+    *pattern_max = 0;
+    for (const char *p = arg; *p; ) {
+        size_t tok = strcspn(p, ",");
+        if (n == SCHEME_MAX) return -1;
+        struct pass_spec *s = &out[n++];
+        *s = (struct pass_spec){ .kind = PASS_PATTERN };
+        if (tok == 6 && strncmp(p, "random", 6) == 0) {
+            s->kind = PASS_RANDOM;
+        } else {
+            const char *h = p;
+            if (tok > 2 && h[0] == '0' && (h[1] == 'x' || h[1] == 'X')) h += 2;
+            size_t digits = tok - (size_t)(h - p);
+            if (digits == 0 || digits % 2 || digits / 2 > PATTERN_MAX) return -1;
+            for (size_t i = 0; i < digits / 2; ++i) {
+                char byte[3] = { h[2 * i], h[2 * i + 1], 0 }, *end;
+                s->pattern[i] = (unsigned char)strtoul(byte, &end, 16);
+                if (*end) return -1;
+            }
+            s->len = (unsigned char)(digits / 2);
+            if (s->len > *pattern_max) *pattern_max = s->len;
+        }
+        p += tok;
+        if (*p == ',' && *++p == '\0') return -1;
+    }
+    return n;
+}
+
+/* "random", "zero" or the pattern in hex, for messages */
+static const char *pass_name(const struct pass_spec *s, char out[2 * PATTERN_MAX + 1]) {
+    if (s->kind != PASS_PATTERN) return s->kind == PASS_ZERO ? "zero" : "random";
+    for (unsigned i = 0; i < s->len; ++i) snprintf(out + 2 * i, 3, "%02x", s->pattern[i]);
+    return out;
+}
+
+/* the pattern's bytes at file offsets [off, off + n) */
+static void pattern_expand(const struct pass_spec *s, off_t off, unsigned char *out, size_t n) {
+    size_t have = s->len < n ? s->len : n;
+    for (size_t i = 0; i < have; ++i) out[i] = s->pattern[(size_t)(off + (off_t)i) % s->len];
+    /* have stays a whole number of periods, so doubling it keeps the phase */
+    while (have < n) {
+        size_t k = have < n - have ? have : n - have;
+        memcpy(out + have, out, k);
+        have += k;
+    }
+}
+
+/*
+ * Per-file diagnostics. With a single worker they go straight to stderr; with
+ * -j each file's messages are collected in a memstream and emitted as one block
+ * once the file is done, so output from concurrent files never interleaves.
+ */
+static __thread FILE *diag_stream;
+
+static FILE *diag(void) {
+    return diag_stream ? diag_stream : stderr;
+}
+
+static void diag_errno(const char *what) {
+    fprintf(diag(), "%s: %s\n", what, strerror(errno));
+}
+
+/* malloc(), or NULL (ENOMEM) once that has been reported; callers fail the file at hand */
+static void *alloc_buf(size_t size) {
+    void *p = malloc(size);
+    if (!p) {
+        fprintf(diag(), "malloc(%zu) failed\n", size);
+        errno = ENOMEM;
+    }
+    return p;
+}
+
+/*
+ * Per-worker buffer arena, mapped on first use and then reused for every file
+ * and pass, so steady-state shredding takes no page faults and the kernel
+ * zeroes no fresh pages per file. Arenas of a hugepage or more try
+ * MAP_HUGETLB, then transparent hugepages, to keep TLB misses down at high
+ * throughput. Arenas are mlock'd (best effort, RLIMIT_MEMLOCK permitting) and
+ * left out of core dumps.
+ */
+#define HUGEPAGE_SIZE ((size_t)2 * 1024 * 1024)
+
+struct arena {
+    unsigned char *base;
+    size_t size;
+    bool huge;                  /* MAP_HUGETLB */
+    bool locked;
+};
+
+static void arena_release(struct arena *a) {
+    if (a->base) {
+        if (a->locked) munlock(a->base, a->size);
+        munmap(a->base, a->size);
+    }
+    memset(a, 0, sizeof(*a));
+}
+
+/* at least size bytes, page aligned, or NULL; the old contents are lost when it grows */
+static unsigned char *arena_get(struct arena *a, size_t size) {
+    if (a->base && a->size >= size) return a->base;
+    arena_release(a);
+    void *p = MAP_FAILED;
+    if (size >= HUGEPAGE_SIZE) {
+        size_t huge = (size + HUGEPAGE_SIZE - 1) / HUGEPAGE_SIZE * HUGEPAGE_SIZE;
+        p = mmap(NULL, huge, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            size = huge;
+            a->huge = true;
+        }
+    }
+    if (p == MAP_FAILED) {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size = (size + page - 1) / page * page;
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            fprintf(diag(), "mmap(%zu) failed\n", size);
+            return NULL;
+        }
+        if (size >= HUGEPAGE_SIZE) madvise(p, size, MADV_HUGEPAGE);
+    }
+    madvise(p, size, MADV_DONTDUMP);
+    a->base = p;
+    a->size = size;
+    a->locked = mlock(p, size) == 0; /* also faults the pages in, once */
+    return a->base;
+}
+
+static ssize_t fill_random(void *buf, size_t len) {
+    /* Try getrandom first */
+    ssize_t got = 0;
+#if defined(SYS_getrandom) || defined(GRND_NONBLOCK)
+    /* use getrandom syscall via wrapper */
+    ssize_t r = 0;
+    size_t left = len;
+    unsigned char *p = buf;
+    while (left) {
+        r = getrandom(p, left, 0);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            got = -1;
+            break;
+        }
+        left -= r;
+        p += r;
+    }
+    if (left == 0) return (ssize_t)len;
+    /* otherwise fall through to /dev/urandom */
+#endif
+
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0) return -1;
+    ssize_t total = 0;
+    while (total < (ssize_t)len) {
+        ssize_t r = read(fd, (unsigned char*)buf + total, len - total);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            total = -1;
+            break;
+        }
+        if (r == 0) break;
+        total += r;
+    }
+    close(fd);
+    return total;
+}
+
+/*
+ * Userspace ChaCha20 keystream (original 64-bit counter / 64-bit nonce layout).
+ * The keystream is addressed by byte offset so any range of a pass can be
+ * generated independently. CHACHA_LANES blocks are computed at once using GCC
+ * vector extensions; on x86-64 an AVX2 clone is selected at load time when the
+ * CPU supports it, otherwise the same code runs on SSE2.
+ */
+#define CHACHA_LANES 8
+#define CHACHA_BATCH (64 * CHACHA_LANES)
+
+typedef uint32_t chacha_vec __attribute__((vector_size(4 * CHACHA_LANES)));
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+#define CHACHA_TARGETS __attribute__((target_clones("avx2", "default")))
+#else
+#define CHACHA_TARGETS
+#endif
+
+struct keystream {
+    uint32_t key[8];
+    uint64_t nonce;
+};
+
+#define CHACHA_ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define CHACHA_QR(a, b, c, d)                       \
+    do {                                            \
+        a += b; d ^= a; d = CHACHA_ROTL(d, 16);     \
+        c += d; b ^= c; b = CHACHA_ROTL(b, 12);     \
+        a += b; d ^= a; d = CHACHA_ROTL(d, 8);      \
+        c += d; b ^= c; b = CHACHA_ROTL(b, 7);      \
+    } while (0)
+
+/* write CHACHA_LANES consecutive 64-byte blocks starting at block `counter` */
+CHACHA_TARGETS
+static void chacha20_blocks(const struct keystream *ks, uint64_t counter, unsigned char *out) {
+    static const uint32_t sigma[4] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574 };
+    chacha_vec in[16], x[16];
+
+    for (int i = 0; i < 4; ++i) in[i] = (chacha_vec){ 0 } + sigma[i];
+    for (int i = 0; i < 8; ++i) in[4 + i] = (chacha_vec){ 0 } + ks->key[i];
+    for (int l = 0; l < CHACHA_LANES; ++l) {
+        uint64_t c = counter + (uint64_t)l;
+        in[12][l] = (uint32_t)c;
+        in[13][l] = (uint32_t)(c >> 32);
+    }
+    in[14] = (chacha_vec){ 0 } + (uint32_t)ks->nonce;
+    in[15] = (chacha_vec){ 0 } + (uint32_t)(ks->nonce >> 32);
+
+    memcpy(x, in, sizeof(x));
+    for (int r = 0; r < 10; ++r) {
+        CHACHA_QR(x[0], x[4], x[8],  x[12]);
+        CHACHA_QR(x[1], x[5], x[9],  x[13]);
+        CHACHA_QR(x[2], x[6], x[10], x[14]);
+        CHACHA_QR(x[3], x[7], x[11], x[15]);
+        CHACHA_QR(x[0], x[5], x[10], x[15]);
+        CHACHA_QR(x[1], x[6], x[11], x[12]);
+        CHACHA_QR(x[2], x[7], x[8],  x[13]);
+        CHACHA_QR(x[3], x[4], x[9],  x[14]);
+    }
+    for (int i = 0; i < 16; ++i) x[i] += in[i];
+
+    /* transpose lanes into consecutive blocks (host byte order) */
+    for (int l = 0; l < CHACHA_LANES; ++l) {
+        uint32_t block[16];
+        for (int i = 0; i < 16; ++i) block[i] = x[i][l];
+        memcpy(out + (size_t)l * 64, block, sizeof(block));
+    }
+}
+
+/* fill buf with the keystream bytes at [offset, offset + len) */
+static void keystream_fill(const struct keystream *ks, uint64_t offset, void *buf, size_t len) {
+    unsigned char tmp[CHACHA_BATCH];
+    unsigned char *p = buf;
+    uint64_t counter = offset / 64;
+    size_t skip = (size_t)(offset % 64);
+
+    while (len) {
+        if (skip == 0 && len >= CHACHA_BATCH) {
+            chacha20_blocks(ks, counter, p);
+            p += CHACHA_BATCH;
+            len -= CHACHA_BATCH;
+        } else {
+            chacha20_blocks(ks, counter, tmp);
+            size_t n = CHACHA_BATCH - skip;
+            if (n > len) n = len;
+            memcpy(p, tmp + skip, n);
+            p += n;
+            len -= n;
+            skip = 0;
+        }
+        counter += CHACHA_LANES;
+    }
+    explicit_bzero(tmp, sizeof(tmp));
+}
+
+/* fresh key and nonce from the kernel RNG */
+static int keystream_seed(struct keystream *ks) {
+    if (fill_random(ks, sizeof(*ks)) != (ssize_t)sizeof(*ks)) return -1;
+    return 0;
+}
+
+/* random data for one chunk of a pass, from the pass's source */
+static int pass_random(enum rng_mode rng, const struct keystream *ks, off_t offset, void *buf, size_t len) {
+    if (rng == RNG_CHACHA) {
+        keystream_fill(ks, (uint64_t)offset, buf, len);
+        return 0;
+    }
+    return fill_random(buf, len) == (ssize_t)len ? 0 : -1;
+}
+
+static int sync_and_check(int fd) {
+    /* Try fdatasync then fsync as a fallback */
+    if (fdatasync(fd) == 0) return 0;
+    if (fsync(fd) == 0) return 0;
+    return -1;
+}
+
+/* 16 random hex chars plus NUL */
+#define RANDOM_NAME_LEN 16
+
+/*
+ * Names come from a per-thread ChaCha20 stream seeded once from getrandom(),
+ * so a name costs no syscall. They only have to be unguessable; collisions
+ * are caught by RENAME_NOREPLACE.
+ */
+static __thread struct keystream name_ks;
+static __thread unsigned char name_pool[CHACHA_BATCH];
+static __thread size_t name_avail;
+static __thread uint64_t name_offset;
+static __thread bool name_seeded;
+
+static int random_name(char out[RANDOM_NAME_LEN + 1]) {
+    static const char hex[] = "0123456789abcdef";
+    if (name_avail < RANDOM_NAME_LEN / 2) {
+        if (!name_seeded && keystream_seed(&name_ks) != 0) return -1;
+        name_seeded = true;
+        keystream_fill(&name_ks, name_offset, name_pool, sizeof(name_pool));
+        name_offset += sizeof(name_pool);
+        name_avail = sizeof(name_pool);
+    }
+    const unsigned char *r = name_pool + sizeof(name_pool) - name_avail;
+    for (int i = 0; i < RANDOM_NAME_LEN / 2; ++i) {
+        out[i * 2] = hex[r[i] >> 4];
+        out[i * 2 + 1] = hex[r[i] & 15];
+    }
+    name_avail -= RANDOM_NAME_LEN / 2;
+    out[RANDOM_NAME_LEN] = '\0';
+    return 0;
+}
+
+/* rename dirfd/name to a random name that did not exist yet, stored in out */
+static int rename_random(int dirfd, const char *name, char out[RANDOM_NAME_LEN + 1]) {
+    for (int tries = 0; tries < 4; ++tries) {
+        if (random_name(out) != 0) return -1;
+        if (renameat2(dirfd, name, dirfd, out, RENAME_NOREPLACE) == 0) return 0;
+        /* filesystems without RENAME_NOREPLACE: a 64-bit name will do */
+        if (errno == EINVAL) return renameat(dirfd, name, dirfd, out);
+        if (errno != EEXIST) return -1;
+    }
+    return -1;
+}
+
+/*
+ * Minimal io_uring wrapper on the raw syscalls (no liburing dependency).
+ * One ring per worker thread; writes are queued up to the queue depth against
+ * registered buffers and each pass ends with a drained fdatasync SQE.
+ */
+struct uring {
+    int fd;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr, *sqe_ptr;
+    size_t sq_len, cq_len, sqe_len;
+    unsigned sq_entries;
+    unsigned pending;           /* SQEs queued since the last submit */
+    bool has_renameat;
+};
+
+#ifdef HAVE_IO_URING
+static int uring_probe(struct uring *r) {
+    size_t len = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, len);
+    if (!probe) return -1;
+    if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) < 0) {
+        free(probe);
+        return -1;
+    }
+    int needed[] = { IORING_OP_WRITE, IORING_OP_WRITE_FIXED, IORING_OP_FSYNC };
+    for (size_t i = 0; i < sizeof(needed) / sizeof(needed[0]); ++i) {
+        if (needed[i] > probe->last_op || !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED)) {
+            free(probe);
+            errno = EOPNOTSUPP;
+            return -1;
+        }
+    }
+    r->has_renameat = probe->last_op >= IORING_OP_RENAMEAT &&
+                      (probe->ops[IORING_OP_RENAMEAT].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    return 0;
+}
+
+static void uring_teardown(struct uring *r) {
+    if (r->sqe_ptr) munmap(r->sqe_ptr, r->sqe_len);
+    if (r->cq_ptr && r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr, r->cq_len);
+    if (r->sq_ptr) munmap(r->sq_ptr, r->sq_len);
+    if (r->fd >= 0) close(r->fd);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+static int uring_setup(struct uring *r, unsigned entries) {
+    struct io_uring_params p;
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+    r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0) return -1;
+
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_len > r->sq_len) r->sq_len = r->cq_len;
+        r->cq_len = r->sq_len;
+    }
+    r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED) { r->cq_ptr = NULL; goto fail; }
+    }
+    r->sqe_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqe_ptr = mmap(NULL, r->sqe_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      r->fd, IORING_OFF_SQES);
+    if (r->sqe_ptr == MAP_FAILED) { r->sqe_ptr = NULL; goto fail; }
+
+    char *sq = r->sq_ptr, *cq = r->cq_ptr;
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->sqes = r->sqe_ptr;
+    r->sq_entries = p.sq_entries;
+    if (uring_probe(r) != 0) goto fail;
+    return 0;
+
+fail:;
+    int saved = errno;
+    if (r->sq_ptr == MAP_FAILED) r->sq_ptr = NULL;
+    uring_teardown(r);
+    errno = saved;
+    return -1;
+}
+
+/* next free SQE, zeroed; the caller guarantees no more than sq_entries are in flight */
+static struct io_uring_sqe *uring_sqe(struct uring *r) {
+    unsigned tail = *r->sq_tail + r->pending;
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    r->pending++;
+    return sqe;
+}
+
+/* submit everything queued and wait until at least wait_nr completions are ready */
+static int uring_submit(struct uring *r, unsigned wait_nr) {
+    __atomic_store_n(r->sq_tail, *r->sq_tail + r->pending, __ATOMIC_RELEASE);
+    unsigned to_submit = r->pending;
+    r->pending = 0;
+    for (;;) {
+        long ret = syscall(__NR_io_uring_enter, r->fd, to_submit, wait_nr,
+                           wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (ret >= 0) {
+            to_submit -= (unsigned)ret;
+            if (to_submit == 0) return 0;
+            continue;
+        }
+        if (errno == EINTR) continue;
+        return -1;
+    }
+}
+
+/* pop one completion if available */
+static bool uring_reap(struct uring *r, struct io_uring_cqe *out) {
+    unsigned head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) return false;
+    *out = r->cqes[head & *r->cq_mask];
+    __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static int uring_register_buffers(struct uring *r, struct iovec *iov, unsigned n) {
+    return (int)syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS, iov, n);
+}
+
+static void uring_unregister_buffers(struct uring *r) {
+    syscall(__NR_io_uring_register, r->fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+}
+#else
+static int uring_setup(struct uring *r, unsigned entries) {
+    (void)entries;
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+    errno = ENOSYS;
+    return -1;
+}
+static void uring_teardown(struct uring *r) { (void)r; }
+#endif
+
+struct bench_stats;
+struct progress_slot;
+
+/*
+ * Per-worker state reused across files: the io_uring instance and its
+ * registered write buffers (one per queue slot).
+ */
+struct worker {
+    struct uring ring;
+    bool ring_ready;
+    bool ring_failed;           /* setup failed once; stay on write() */
+    bool bufs_registered;
+    struct arena arena;         /* write() buffers, the -P ring and stripe buffers */
+    struct arena uring_arena;   /* backs bufs, registered with the ring */
+    unsigned char *bufs;        /* nbufs * bufsize bytes */
+    size_t bufsize;
+    unsigned nbufs;
+    struct uring_slot *slots;
+    struct bench_stats *bench;  /* --bench: pass timings are recorded here */
+    struct progress_slot *prog; /* -p: this worker's slot, claimed on first use */
+    bool geom_valid;            /* dio_alignment()/auto_chunk()/fstatfs() of geom_dev */
+    dev_t geom_dev;
+    size_t geom_align, geom_chunk;
+    long geom_fs;               /* statfs f_type */
+    bool dir_open;              /* dir_fd is the directory dir_key names */
+    int dir_fd;
+    dev_t dir_dev;              /* what dir_fd is, to notice dir_key naming another directory since */
+    ino_t dir_ino;
+    size_t dir_key_len;
+    char dir_key[PATH_MAX];     /* directory part of the last path, with its slash */
+    char (*renamed)[RANDOM_NAME_LEN + 1]; /* -j/--files-from paths renamed in dir_fd, see worker_flush() */
+    unsigned nrenamed;
+    bool flush_failed;          /* an unlink in worker_flush() failed; the pool takes note */
+    uid_t owner;                /* --daemon: the running request's client, whose files alone it may shred (0 = any) */
+    struct arena verify_arena;  /* --verify: readback and expected-data buffers */
+};
+
+struct uring_slot {
+    off_t off;
+    size_t len;
+    size_t done;
+    double t0;                  /* --adaptive: when the write was queued */
+    const unsigned char *src;   /* pattern pass: write from here, not the slot's buffer */
+};
+
+static void worker_release(struct worker *w) {
+    if (w->ring_ready) uring_teardown(&w->ring);
+    if (w->dir_open) close(w->dir_fd);
+    arena_release(&w->arena);
+    arena_release(&w->uring_arena);
+    arena_release(&w->verify_arena);
+    free(w->renamed);
+    free(w->slots);
+    memset(w, 0, sizeof(*w));
+}
+
+/* a failed io_uring_enter leaves SQEs of unknown state; never reuse that ring */
+static void worker_drop_ring(struct worker *w) {
+    if (w->ring_ready) uring_teardown(&w->ring);
+    w->ring_ready = false;
+    w->ring_failed = true;
+    w->bufs_registered = false;
+}
+
+#ifdef HAVE_IO_URING
+/* make sure the worker has a ring for and exactly queue_depth buffers of at least bufsize bytes */
+static int worker_uring(struct worker *w, const struct shred_opts *o, size_t bufsize) {
+    if (w->ring_failed) return -1;
+    /* a library thread may come back with a deeper queue than its ring was made for */
+    if (w->ring_ready && w->ring.sq_entries < o->queue_depth + 3) {
+        uring_teardown(&w->ring);
+        w->ring_ready = false;
+        w->bufs_registered = false;
+    }
+    bool fresh = !w->ring_ready;
+    if (fresh) {
+        /* queue depth writes plus the pass fsync, or a rename/fsync pair */
+        if (uring_setup(&w->ring, o->queue_depth + 3) != 0) {
+            if (o->verbose) diag_errno("io_uring_setup (falling back to write())");
+            w->ring_failed = true;
+            return -1;
+        }
+        w->ring_ready = true;
+    }
+    if (!fresh && w->bufs && w->bufsize >= bufsize && w->nbufs == o->queue_depth) return 0;
+
+    if (w->bufs_registered) uring_unregister_buffers(&w->ring);
+    w->bufs_registered = false;
+    free(w->slots);
+    w->nbufs = o->queue_depth;
+    w->bufsize = bufsize;
+    w->bufs = arena_get(&w->uring_arena, w->nbufs * bufsize);
+    w->slots = alloc_buf(w->nbufs * sizeof(*w->slots));
+    if (!w->bufs || !w->slots) {
+        /* the ring stays; the next call tries the buffers again */
+        free(w->slots);
+        w->slots = NULL;
+        w->bufs = NULL;
+        w->nbufs = 0;
+        w->bufsize = 0;
+        return -1;
+    }
+
+    struct iovec iov[w->nbufs];
+    for (unsigned i = 0; i < w->nbufs; ++i) {
+        iov[i].iov_base = w->bufs + (size_t)i * bufsize;
+        iov[i].iov_len = bufsize;
+    }
+    /* unregistered buffers still work, just with per-I/O page pinning */
+    w->bufs_registered = uring_register_buffers(&w->ring, iov, w->nbufs) == 0;
+    return 0;
+}
+#else
+static int worker_uring(struct worker *w, const struct shred_opts *o, size_t bufsize) {
+    (void)bufsize;
+    if (!w->ring_failed && o->verbose)
+        fprintf(diag(), "io_uring not supported by this build, using write()\n");
+    w->ring_failed = true;
+    return -1;
+}
+#endif
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * -p / --progress-json: the passes only bump relaxed atomic counters; a
+ * reporter thread samples them once a second and does all the formatting, so
+ * the write loops never touch stdio. Each worker owns one slot for the file it
+ * is on. The slot's path and byte total change once per file, under its lock.
+ */
+struct progress_slot {
+    pthread_mutex_t lock;
+    char path[PATH_MAX];
+    uint64_t total;             /* bytes this file's passes will write; 0 = idle */
+    double start;
+    _Atomic uint64_t done;
+};
+
+static struct progress {
+    bool human;                 /* -p: lines on stderr */
+    bool json;                  /* --progress-json: JSON lines on stdout */
+    struct progress_slot *slots;
+    unsigned nslots;
+    _Atomic unsigned claimed;
+    _Atomic uint64_t bytes;     /* written so far, all files */
+    _Atomic uint64_t settled;   /* bytes of failed files that will never be written */
+    _Atomic int64_t total;      /* overall target; valid if total_known */
+    bool total_known;           /* false with -r, where the tree is found as we go */
+    _Atomic uint64_t files_done;
+    double start;
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t stop_cond;
+    bool stop;
+} progress;
+
+static bool progress_on(void) {
+    return progress.human || progress.json;
+}
+
+static struct progress_slot *progress_claim(void) {
+    unsigned i = atomic_fetch_add(&progress.claimed, 1);
+    return i < progress.nslots ? &progress.slots[i] : NULL;
+}
+
+static void progress_begin(struct progress_slot *s, const char *path, uint64_t total) {
+    pthread_mutex_lock(&s->lock);
+    snprintf(s->path, sizeof(s->path), "%s", path);
+    s->total = total;
+    s->start = now_sec();
+    atomic_store_explicit(&s->done, 0, memory_order_relaxed);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void progress_end(struct progress_slot *s) {
+    pthread_mutex_lock(&s->lock);
+    uint64_t done = atomic_load_explicit(&s->done, memory_order_relaxed);
+    if (done < s->total) atomic_fetch_add_explicit(&progress.settled, s->total - done, memory_order_relaxed);
+    s->total = 0;
+    pthread_mutex_unlock(&s->lock);
+    atomic_fetch_add_explicit(&progress.files_done, 1, memory_order_relaxed);
+}
+
+/* the hot path: two relaxed adds per chunk */
+static inline void progress_add(struct progress_slot *s, uint64_t n) {
+    if (!s) return;
+    atomic_fetch_add_explicit(&s->done, n, memory_order_relaxed);
+    atomic_fetch_add_explicit(&progress.bytes, n, memory_order_relaxed);
+}
+
+#ifndef SHREDDER_LIBRARY
+/* -p / --progress-json: the reporter thread */
+static void json_string(FILE *out, const char *str) {
+    fputc('"', out);
+    for (const unsigned char *c = (const unsigned char *)str; *c; ++c) {
+        if (*c == '"' || *c == '\\') fprintf(out, "\\%c", *c);
+        else if (*c < 0x20) fprintf(out, "\\u%04x", *c);
+        else fputc(*c, out);
+    }
+    fputc('"', out);
+}
+
+static void format_eta(char *out, size_t n, double secs) {
+    if (secs < 0) {
+        snprintf(out, n, "--:--:--");
+        return;
+    }
+    uint64_t t = (uint64_t)(secs + 0.5);
+    snprintf(out, n, "%" PRIu64 ":%02u:%02u", t / 3600, (unsigned)(t / 60 % 60), (unsigned)(t % 60));
+}
+
+/* rate and ETA from the average since start; -1 when there is nothing to go on */
+static double eta_secs(uint64_t done, uint64_t total, double elapsed) {
+    if (!total || !done || elapsed <= 0) return -1;
+    if (done >= total) return 0;
+    return (double)(total - done) / ((double)done / elapsed);
+}
+
+static void progress_report(bool final) {
+    double now = now_sec(), elapsed = now - progress.start;
+    uint64_t bytes = atomic_load_explicit(&progress.bytes, memory_order_relaxed);
+    uint64_t done = bytes + atomic_load_explicit(&progress.settled, memory_order_relaxed);
+    uint64_t total = progress.total_known ? (uint64_t)atomic_load(&progress.total) : 0;
+    uint64_t files = atomic_load_explicit(&progress.files_done, memory_order_relaxed);
+    double mib = (double)bytes / (1024.0 * 1024.0), rate = elapsed > 0 ? mib / elapsed : 0.0;
+    double pct = total ? 100.0 * (double)(done < total ? done : total) / (double)total : -1;
+    double eta = eta_secs(done, total, elapsed);
+    char etabuf[32];
+
+    if (progress.json) {
+        printf("{\"t\":%.3f,\"final\":%s,\"bytes\":%" PRIu64 ",\"total\":%" PRIu64 ",\"pct\":%.2f,"
+               "\"mib_s\":%.1f,\"eta_s\":%.0f,\"files_done\":%" PRIu64 ",\"files\":[",
+               elapsed, final ? "true" : "false", bytes, total, pct, rate, eta, files);
+    }
+    if (progress.human) {
+        format_eta(etabuf, sizeof(etabuf), eta);
+        if (total)
+            fprintf(stderr, "[%5.1f%%] %.1f MiB, %.1f MiB/s, ETA %s, %" PRIu64 " files done\n",
+                    pct, mib, rate, etabuf, files);
+        else
+            fprintf(stderr, "[progress] %.1f MiB, %.1f MiB/s, %" PRIu64 " files done\n", mib, rate, files);
+    }
+    bool first = true;
+    for (unsigned i = 0; i < progress.nslots && !final; ++i) {
+        struct progress_slot *s = &progress.slots[i];
+        pthread_mutex_lock(&s->lock);
+        if (s->total) {
+            uint64_t fd = atomic_load_explicit(&s->done, memory_order_relaxed);
+            double fe = now - s->start, fmib = (double)fd / (1024.0 * 1024.0);
+            double fpct = 100.0 * (double)(fd < s->total ? fd : s->total) / (double)s->total;
+            double feta = eta_secs(fd, s->total, fe);
+            if (progress.json) {
+                printf("%s{\"path\":", first ? "" : ",");
+                json_string(stdout, s->path);
+                printf(",\"bytes\":%" PRIu64 ",\"total\":%" PRIu64 ",\"pct\":%.2f,\"mib_s\":%.1f,\"eta_s\":%.0f}",
+                       fd, s->total, fpct, fe > 0 ? fmib / fe : 0.0, feta);
+            }
+            if (progress.human) {
+                format_eta(etabuf, sizeof(etabuf), feta);
+                fprintf(stderr, "  %5.1f%% %.1f MiB/s ETA %s %s\n", fpct, fe > 0 ? fmib / fe : 0.0, etabuf, s->path);
+            }
+            first = false;
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+    if (progress.json) {
+        printf("]}\n");
+        fflush(stdout);
+    }
+}
+
+static void *progress_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&progress.lock);
+    while (!progress.stop) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += 1;
+        if (pthread_cond_timedwait(&progress.stop_cond, &progress.lock, &ts) == ETIMEDOUT && !progress.stop) {
+            pthread_mutex_unlock(&progress.lock);
+            progress_report(false);
+            pthread_mutex_lock(&progress.lock);
+        }
+    }
+    pthread_mutex_unlock(&progress.lock);
+    return NULL;
+}
+
+/* nslots: the most files in flight at once (one per worker) */
+static void progress_start(unsigned nslots, int64_t total, bool total_known) {
+    progress.slots = alloc_buf(nslots * sizeof(*progress.slots));
+    /* without slots only the overall line is shown */
+    progress.nslots = progress.slots ? nslots : 0;
+    for (unsigned i = 0; i < progress.nslots; ++i) {
+        pthread_mutex_init(&progress.slots[i].lock, NULL);
+        progress.slots[i].total = 0;
+        atomic_init(&progress.slots[i].done, 0);
+    }
+    atomic_store(&progress.total, total);
+    progress.total_known = total_known;
+    progress.start = now_sec();
+    pthread_mutex_init(&progress.lock, NULL);
+    pthread_cond_init(&progress.stop_cond, NULL);
+    if (pthread_create(&progress.tid, NULL, progress_main, NULL) != 0) progress.tid = pthread_self();
+}
+
+static void progress_finish(void) {
+    pthread_mutex_lock(&progress.lock);
+    progress.stop = true;
+    pthread_cond_signal(&progress.stop_cond);
+    pthread_mutex_unlock(&progress.lock);
+    if (!pthread_equal(progress.tid, pthread_self())) pthread_join(progress.tid, NULL);
+    progress_report(true);
+    free(progress.slots);
+}
+#endif /* SHREDDER_LIBRARY */
+
+/*
+ * --max-rate / --adaptive: one token bucket shared by every writer thread, so
+ * the limit holds for the process as a whole whatever -j, -W or -e say.
+ * Writers take tokens for a chunk before writing it; the bucket may go into
+ * debt, which the writer sleeps off outside the lock, so concurrent writers
+ * queue up behind each other at the configured rate.
+ *
+ * --adaptive also feeds back each write's latency. Every ADAPT_WINDOW the mean
+ * latency per byte is compared with the best window seen so far: above
+ * ADAPT_CONGESTED times that, the device is taken to be busy with someone
+ * else's I/O and the rate is halved from what was achieved; otherwise it
+ * grows by a tenth, up to --max-rate if one is set.
+ */
+#define ADAPT_WINDOW 0.1
+#define ADAPT_CONGESTED 3.0
+#define ADAPT_MIN_RATE (1024.0 * 1024.0)
+
+/* ioprio_set(2); glibc has no wrapper and not every toolchain ships <linux/ioprio.h> */
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+
+static struct throttle {
+    bool on;
+    bool adaptive;
+    double cap;                 /* --max-rate in bytes/s, 0 = none */
+    pthread_mutex_t lock;
+    double rate;                /* current limit, 0 = unlimited */
+    double tokens;
+    double stamp;               /* last refill */
+    double win_start, win_bytes, win_lat;
+    double base;                /* best window's seconds per byte */
+} throttle = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static void throttle_take(size_t n) {
+    if (!throttle.on) return;
+    double wait = 0;
+    pthread_mutex_lock(&throttle.lock);
+    double now = now_sec();
+    if (throttle.rate > 0) {
+        double burst = throttle.rate * ADAPT_WINDOW;
+        throttle.tokens += (now - throttle.stamp) * throttle.rate;
+        if (throttle.tokens > burst) throttle.tokens = burst;
+        throttle.tokens -= (double)n;
+        if (throttle.tokens < 0) wait = -throttle.tokens / throttle.rate;
+    }
+    throttle.stamp = now;
+    pthread_mutex_unlock(&throttle.lock);
+    if (wait > 0) {
+        struct timespec ts = { (time_t)wait, (long)((wait - (double)(time_t)wait) * 1e9) };
+        while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {}
+    }
+}
+
+/* start time of a write for throttle_observe() and --stats; 0 if neither wants it */
+static bool write_timed;
+
+static inline double write_clock(void) {
+    return write_timed ? now_sec() : 0;
+}
+
+/* a write of n bytes that started at t0 has completed */
+static void throttle_observe(double t0, size_t n) {
+    if (!throttle.adaptive) return;
+    pthread_mutex_lock(&throttle.lock);
+    double now = now_sec();
+    if (throttle.win_start == 0) throttle.win_start = t0;
+    throttle.win_bytes += (double)n;
+    throttle.win_lat += now - t0;
+    double span = now - throttle.win_start;
+    if (span >= ADAPT_WINDOW) {
+        double lat = throttle.win_lat / throttle.win_bytes, achieved = throttle.win_bytes / span;
+        if (throttle.base == 0 || lat < throttle.base) throttle.base = lat;
+        else throttle.base += (lat - throttle.base) / 64; /* let a change of device settle in */
+        if (lat > throttle.base * ADAPT_CONGESTED) {
+            throttle.rate = achieved / 2 > ADAPT_MIN_RATE ? achieved / 2 : ADAPT_MIN_RATE;
+        } else if (throttle.rate > 0) {
+            throttle.rate *= 1.1;
+            if (throttle.cap > 0 && throttle.rate > throttle.cap) throttle.rate = throttle.cap;
+        }
+        throttle.win_start = now;
+        throttle.win_bytes = throttle.win_lat = 0;
+    }
+    pthread_mutex_unlock(&throttle.lock);
+}
+
+/*
+ * --stats: where the time goes. Each phase of a shred is timed with
+ * CLOCK_MONOTONIC and counted into a log-linear histogram (HIST_SUB buckets
+ * per power of two, so percentiles are good to about 1/HIST_SUB) belonging to
+ * the calling thread; recording is increments on thread-local memory, no
+ * locks or atomics. Sets of threads that exit go back on a free list for the
+ * next thread, and all sets are merged into the report at exit.
+ */
+enum stat_phase {
+    STAT_OPEN,                  /* open + fstat, until the first pass can start */
+    STAT_RNG,                   /* random data for one chunk */
+    STAT_WRITE,                 /* one chunk written (io_uring: queued to completed) */
+    STAT_SYNC,                  /* pass-ending fdatasync */
+    STAT_OFFLOAD,               /* zero pass via fallocate/BLKZEROOUT */
+    STAT_RENAME,
+    STAT_DIR_FSYNC,
+    STAT_UNLINK,
+    STAT_URING_META,            /* linked rename + fsync(dir), then unlink */
+    STAT_VERIFY,                /* --verify readback of one file */
+    STAT_DISCARD,               /* --discard of one file or device */
+    STAT_FILE,                  /* one file, open to unlink (-r: to rename, the batch unlinks) */
+    STAT_FILE_RATE,             /* bytes per second of one file's passes */
+    STAT_PHASES
+};
+
+#ifndef SHREDDER_LIBRARY
+static const char *const stat_names[STAT_PHASES] = {
+    "open", "rng", "write", "sync", "offload", "rename", "dir_fsync", "unlink", "uring_meta", "verify",
+    "discard", "file", "file_rate",
+};
+#endif /* SHREDDER_LIBRARY */
+
+#define HIST_SUB 8
+#define HIST_BUCKETS (64 * HIST_SUB)
+
+struct hist {
+    uint64_t count, max;
+    double sum;
+    uint64_t b[HIST_BUCKETS];
+};
+
+struct stat_set {
+    struct hist h[STAT_PHASES];
+    struct stat_set *next, *next_free;
+};
+
+static struct {
+    bool on;
+    bool csv;
+    pthread_mutex_t lock;
+    pthread_key_t key;          /* hands a thread's set back when it exits */
+    struct stat_set *all, *free;
+} stats = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static __thread struct stat_set *thread_stats;
+
+#ifndef SHREDDER_LIBRARY
+static void stats_release(void *arg) {
+    struct stat_set *s = arg;
+    pthread_mutex_lock(&stats.lock);
+    s->next_free = stats.free;
+    stats.free = s;
+    pthread_mutex_unlock(&stats.lock);
+}
+#endif /* SHREDDER_LIBRARY */
+
+static struct stat_set *stats_set(void) {
+    if (thread_stats) return thread_stats;
+    pthread_mutex_lock(&stats.lock);
+    struct stat_set *s = stats.free;
+    if (s) {
+        stats.free = s->next_free;
+    } else {
+        s = calloc(1, sizeof(*s));
+        if (!s) {
+            pthread_mutex_unlock(&stats.lock);
+            return NULL;
+        }
+        s->next = stats.all;
+        stats.all = s;
+    }
+    pthread_mutex_unlock(&stats.lock);
+    pthread_setspecific(stats.key, s);
+    return thread_stats = s;
+}
+
+static unsigned hist_index(uint64_t v) {
+    if (v < HIST_SUB) return (unsigned)v;
+    unsigned e = 63 - (unsigned)__builtin_clzll(v); /* >= 3 */
+    return (e - 2) * HIST_SUB + (unsigned)((v >> (e - 3)) & (HIST_SUB - 1));
+}
+
+static void stat_add(enum stat_phase ph, uint64_t v) {
+    if (!stats.on) return;
+    struct stat_set *s = stats_set();
+    if (!s) return; /* out of memory: this thread's samples are dropped */
+    struct hist *h = &s->h[ph];
+    h->count++;
+    h->sum += (double)v;
+    if (v > h->max) h->max = v;
+    h->b[hist_index(v)]++;
+}
+
+/* start time for stat_since(), 0 unless --stats */
+static inline double stat_clock(void) {
+    return stats.on ? now_sec() : 0;
+}
+
+static void stat_since(enum stat_phase ph, double t0) {
+    if (stats.on) stat_add(ph, (uint64_t)((now_sec() - t0) * 1e9));
+}
+
+static void stat_secs(enum stat_phase ph, double secs) {
+    if (stats.on) stat_add(ph, (uint64_t)(secs * 1e9));
+}
+
+#ifndef SHREDDER_LIBRARY
+/* midpoint of bucket i */
+static double hist_value(unsigned i) {
+    if (i < HIST_SUB) return i;
+    unsigned e = i / HIST_SUB + 2;
+    double lo = (double)((uint64_t)(HIST_SUB + i % HIST_SUB) << (e - 3));
+    return lo + (double)((uint64_t)1 << (e - 3)) / 2;
+}
+
+static double hist_pct(const struct hist *h, double q) {
+    uint64_t want = (uint64_t)(q * (double)h->count + 0.5), seen = 0;
+    if (want == 0) want = 1;
+    for (unsigned i = 0; i < HIST_BUCKETS; ++i) {
+        seen += h->b[i];
+        if (seen >= want) {
+            double v = hist_value(i);
+            return v < (double)h->max ? v : (double)h->max;
+        }
+    }
+    return (double)h->max;
+}
+
+/* merge every thread's histograms and print one JSON object or a CSV table on stdout */
+static void stats_report(double wall) {
+    static struct hist sum[STAT_PHASES];
+    for (struct stat_set *s = stats.all; s; s = s->next) {
+        for (int p = 0; p < STAT_PHASES; ++p) {
+            struct hist *d = &sum[p];
+            const struct hist *h = &s->h[p];
+            d->count += h->count;
+            d->sum += h->sum;
+            if (h->max > d->max) d->max = h->max;
+            for (unsigned i = 0; i < HIST_BUCKETS; ++i) d->b[i] += h->b[i];
+        }
+    }
+    if (stats.csv) printf("phase,unit,count,p50,p99,max,total\n");
+    else printf("{\"stats\":{\"wall_s\":%.3f", wall);
+    for (int p = 0; p < STAT_PHASES; ++p) {
+        const struct hist *h = &sum[p];
+        if (!h->count) continue;
+        /* latencies are kept in ns and shown in us; the file rate in bytes/s, shown in MiB/s */
+        bool rate = p == STAT_FILE_RATE;
+        const char *unit = rate ? "mib_s" : "us";
+        double scale = rate ? 1.0 / (1024.0 * 1024.0) : 1e-3;
+        double p50 = hist_pct(h, 0.50) * scale, p99 = hist_pct(h, 0.99) * scale, max = (double)h->max * scale;
+        /* total: seconds spent in the phase, or for the rate its mean */
+        double total = rate ? h->sum / (double)h->count * scale : h->sum / 1e9;
+        if (stats.csv)
+            printf("%s,%s,%" PRIu64 ",%.1f,%.1f,%.1f,%.3f\n", stat_names[p], rate ? "MiB/s" : "us", h->count,
+                   p50, p99, max, total);
+        else
+            printf(",\"%s\":{\"count\":%" PRIu64 ",\"p50_%s\":%.1f,\"p99_%s\":%.1f,\"max_%s\":%.1f,\"%s\":%.3f}",
+                   stat_names[p], h->count, unit, p50, unit, p99, unit, max, rate ? "mean_mib_s" : "total_s",
+                   total);
+    }
+    if (!stats.csv) printf("}}\n");
+    fflush(stdout);
+}
+#endif /* SHREDDER_LIBRARY */
+
+/*
+ * --journal: a crash or SIGTERM halfway through a multi-terabyte overwrite
+ * should not mean starting over. Files of at least --journal-interval bytes
+ * get a line appended (and fdatasync()ed) after every sync that succeeds,
+ * saying which pass is running and how much of it is on stable storage; the
+ * write engine also syncs and checkpoints every interval within a pass. A
+ * later run with the same journal skips what was already done. Lines are
+ *   C dev ino size mtime btime pass offset
+ *   D dev ino
+ * (D once the file is fully overwritten), the last one per file winning.
+ *
+ * Our own writes move mtime, so a file is recognised by dev/ino/size plus the
+ * birth time where statx() reports one, or else its original mtime, which
+ * every checkpoint puts back on the file.
+ */
+struct journal_id {
+    uint64_t dev, ino;
+    int64_t size;
+    struct timespec mtime;      /* before the first pass */
+    struct timespec btime;      /* zero if the filesystem has none */
+};
+
+struct journal_rec {
+    struct journal_id id;
+    int pass;                   /* journal_open(): -1 for a D line */
+    int64_t off;                /* [0, off) of that pass is synced */
+    size_t seq;                 /* journal_open(): line number, so the last line per file wins */
+};
+
+static struct journal {
+    int fd;                     /* -1: no journal */
+    off_t interval;
+    pthread_mutex_t lock;
+    struct journal_rec *recs;   /* loaded at startup sorted by dev/ino, read-only afterwards */
+    size_t nrecs;
+} journal = { .fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static volatile sig_atomic_t shred_interrupted;
+
+static int journal_key_cmp(const void *a, const void *b) {
+    const struct journal_id *x = &((const struct journal_rec *)a)->id, *y = &((const struct journal_rec *)b)->id;
+    if (x->dev != y->dev) return x->dev < y->dev ? -1 : 1;
+    return (x->ino > y->ino) - (x->ino < y->ino);
+}
+
+static const struct journal_rec *journal_find(uint64_t dev, uint64_t ino) {
+    struct journal_rec key = { .id = { .dev = dev, .ino = ino } };
+    return journal.nrecs ? bsearch(&key, journal.recs, journal.nrecs, sizeof(key), journal_key_cmp) : NULL;
+}
+
+static int journal_format(char *out, size_t n, const struct journal_rec *r) {
+    const struct journal_id *id = &r->id;
+    return snprintf(out, n, "C %" PRIu64 " %" PRIu64 " %" PRId64 " %lld.%09ld %lld.%09ld %d %" PRId64 "\n",
+                    id->dev, id->ino, id->size, (long long)id->mtime.tv_sec, id->mtime.tv_nsec,
+                    (long long)id->btime.tv_sec, id->btime.tv_nsec, r->pass, r->off);
+}
+
+#ifndef SHREDDER_LIBRARY
+static void on_stop_signal(int sig) {
+    (void)sig;
+    shred_interrupted = 1;
+}
+
+static int journal_line_cmp(const void *a, const void *b) {
+    int c = journal_key_cmp(a, b);
+    if (c) return c;
+    size_t x = ((const struct journal_rec *)a)->seq, y = ((const struct journal_rec *)b)->seq;
+    return (x > y) - (x < y);
+}
+
+/*
+ * replay path into journal.recs, then rewrite it compacted and keep it open
+ * for appending. Every line is loaded, then sorted by file and line number and
+ * cut down to each file's last line, so a million-file journal loads in
+ * O(n log n) and journal_find() is a binary search.
+ */
+static int journal_open(const char *path, off_t interval) {
+    FILE *in = fopen(path, "r");
+    char line[256];
+    size_t cap = 0;
+    while (in && fgets(line, sizeof(line), in)) {
+        struct journal_rec r = { 0 };
+        long long ms, bs;
+        if (sscanf(line, "C %" SCNu64 " %" SCNu64 " %" SCNd64 " %lld.%ld %lld.%ld %d %" SCNd64, &r.id.dev,
+                   &r.id.ino, &r.id.size, &ms, &r.id.mtime.tv_nsec, &bs, &r.id.btime.tv_nsec, &r.pass,
+                   &r.off) == 9) {
+            r.id.mtime.tv_sec = (time_t)ms;
+            r.id.btime.tv_sec = (time_t)bs;
+        } else if (sscanf(line, "D %" SCNu64 " %" SCNu64, &r.id.dev, &r.id.ino) == 2) {
+            r.pass = -1;
+        } else {
+            continue;
+        }
+        if (journal.nrecs == cap) {
+            cap = cap ? cap * 2 : 1024;
+            struct journal_rec *recs = realloc(journal.recs, cap * sizeof(*recs));
+            if (!recs) {
+                fclose(in);
+                return -1;
+            }
+            journal.recs = recs;
+        }
+        r.seq = journal.nrecs;
+        journal.recs[journal.nrecs++] = r;
+    }
+    if (in) fclose(in);
+    else if (errno != ENOENT) return -1;
+
+    qsort(journal.recs, journal.nrecs, sizeof(*journal.recs), journal_line_cmp);
+    size_t kept = 0;
+    for (size_t i = 0; i < journal.nrecs; ++i) {
+        bool last = i + 1 == journal.nrecs || journal_key_cmp(&journal.recs[i], &journal.recs[i + 1]) != 0;
+        if (last && journal.recs[i].pass >= 0) journal.recs[kept++] = journal.recs[i];
+    }
+    journal.nrecs = kept;
+
+    char tmp[PATH_MAX];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+    if (fd < 0) return -1;
+    for (size_t i = 0; i < journal.nrecs; ++i) {
+        int n = journal_format(line, sizeof(line), &journal.recs[i]);
+        if (write(fd, line, (size_t)n) != n) goto fail;
+    }
+    if (fdatasync(fd) != 0 || rename(tmp, path) != 0) goto fail;
+    journal.fd = fd;
+    journal.interval = interval;
+    return 0;
+fail:
+    close(fd);
+    unlink(tmp);
+    return -1;
+}
+#endif /* SHREDDER_LIBRARY */
+
+static void journal_append(const char *line, int n, bool sync, bool verbose) {
+    pthread_mutex_lock(&journal.lock);
+    if (write(journal.fd, line, (size_t)n) != n || (sync && fdatasync(journal.fd) != 0))
+        if (verbose) diag_errno("journal");
+    pthread_mutex_unlock(&journal.lock);
+}
+
+static void journal_identify(int fd, const struct stat *st, off_t size, struct journal_id *id) {
+    *id = (struct journal_id){ .dev = st->st_dev, .ino = st->st_ino, .size = size, .mtime = st->st_mtim };
+    struct statx stx;
+    if (statx(fd, "", AT_EMPTY_PATH, STATX_BTIME, &stx) == 0 && (stx.stx_mask & STATX_BTIME)) {
+        id->btime.tv_sec = stx.stx_btime.tv_sec;
+        id->btime.tv_nsec = stx.stx_btime.tv_nsec;
+    }
+}
+
+/* the checkpoint for the file identified by cur, if there is one */
+static bool journal_lookup(const struct journal_id *cur, struct journal_rec *out) {
+    const struct journal_rec *r = journal_find(cur->dev, cur->ino);
+    if (!r || r->id.size != cur->size) return false;
+    bool have_btime = (r->id.btime.tv_sec || r->id.btime.tv_nsec) && (cur->btime.tv_sec || cur->btime.tv_nsec);
+    const struct timespec *a = have_btime ? &r->id.btime : &r->id.mtime;
+    const struct timespec *b = have_btime ? &cur->btime : &cur->mtime;
+    if (a->tv_sec != b->tv_sec || a->tv_nsec != b->tv_nsec) return false;
+    *out = *r;
+    return true;
+}
+
+struct extent {
+    off_t off, end;
+};
+
+/* one file being overwritten */
+struct shred_file {
+    const char *path;
+    const struct shred_opts *o;
+    struct worker *w;
+    int fd;
+    off_t size;
+    bool direct;
+    bool write_behind;          /* this pass skips fdatasync; stream writeback instead */
+    off_t direct_end;           /* [0, direct_end) goes through fd */
+    int tail_fd;                /* buffered fd for the unaligned O_DIRECT tail, or -1 */
+    size_t bufsize;
+    void *buf;                  /* write() engine only */
+    struct extent *ext;         /* ranges to overwrite, sorted; &whole unless --sparse */
+    size_t next;
+    struct extent whole;
+    off_t data_bytes;           /* sum of the extents */
+    double sync_secs;           /* time the last pass spent in its final sync */
+    bool blkdev;                /* block device: BLKZEROOUT instead of fallocate */
+    bool mapped;                /* -e mmap: fd is O_RDWR, passes go through mmap_pass() */
+    unsigned char *ring;        /* -P: ring_n buffers of bufsize, or NULL */
+    unsigned ring_n;
+    struct progress_slot *prog; /* -p: counters bumped per chunk, or NULL */
+    uint64_t progress_total;    /* bytes this file's passes will write, for o->progress */
+    struct stripe *stripes;     /* block devices: nstripes parallel writers, or NULL */
+    unsigned nstripes;
+    struct keystream ks;
+    enum rng_mode rng;          /* this pass's source; -R, or chacha for a pass --verify rereads */
+    unsigned char *pattern;     /* pattern passes: pat_len buffers, one per phase */
+    unsigned pat_len;           /* 0 until pattern_fill(); then the pattern now in them */
+    unsigned char pat[PATTERN_MAX];
+    bool journal;               /* --journal: checkpoint this file */
+    struct journal_id jid;
+    int pass;                   /* 1-based pass being written, zero pass last */
+    off_t start_off;            /* resumed pass: skip chunks below this */
+    off_t checkpoint_at;        /* write engine: next mid-pass checkpoint */
+    off_t frontier;             /* write engine: [0, frontier) of this pass written */
+    bool synced;                /* the last pass ended in a successful fdatasync */
+    bool interrupted;           /* SIGINT/SIGTERM under --journal */
+};
+
+/* -p counters and the library's progress callback, for n bytes of f just written */
+static inline void file_progress(const struct shred_file *f, uint64_t n) {
+    progress_add(f->prog, n);
+    if (f->o->progress) f->o->progress(f->o->progress_arg, f->path, n, f->progress_total);
+}
+
+/* read /sys/dev/block/MAJ:MIN/queue/<attr>; partitions use their parent disk's queue */
+static int sysfs_queue_attr(dev_t dev, const char *attr, unsigned long *out) {
+    char p[128];
+    snprintf(p, sizeof(p), "/sys/dev/block/%u:%u/queue/%s", major(dev), minor(dev), attr);
+    FILE *fp = fopen(p, "r");
+    if (!fp) {
+        snprintf(p, sizeof(p), "/sys/dev/block/%u:%u/../queue/%s", major(dev), minor(dev), attr);
+        fp = fopen(p, "r");
+    }
+    if (!fp) return -1;
+    int ok = fscanf(fp, "%lu", out) == 1;
+    fclose(fp);
+    return ok ? 0 : -1;
+}
+
+/* O_DIRECT offset/length alignment for a file: the backing device's logical block size */
+static size_t dio_alignment(const struct stat *st) {
+    unsigned long lbs = 0;
+    dev_t dev = S_ISBLK(st->st_mode) ? st->st_rdev : st->st_dev;
+    if (sysfs_queue_attr(dev, "logical_block_size", &lbs) != 0 || lbs < 512 || (lbs & (lbs - 1)))
+        lbs = 4096; /* unknown (dm, network fs, ...): 4 KiB satisfies everything common */
+    return (size_t)lbs;
+}
+
+/*
+ * -b auto: start from the default CHUNK and round it up to whole stripes
+ * (optimal_io_size) or, failing that, whole maximum-size requests
+ * (max_sectors_kb), never smaller than st_blksize. Files without a block
+ * queue behind them (NFS, CIFS, FUSE) report their transfer size in
+ * st_blksize; keep several of those in each write.
+ */
+#define AUTO_CHUNK_MAX ((size_t)64 * 1024 * 1024)
+
+static size_t auto_chunk(const struct stat *st) {
+    size_t unit = st->st_blksize > 0 ? (size_t)st->st_blksize : 4096;
+    unsigned long io_opt = 0, max_kb = 0;
+    dev_t dev = S_ISBLK(st->st_mode) ? st->st_rdev : st->st_dev;
+    bool have_queue = sysfs_queue_attr(dev, "max_sectors_kb", &max_kb) == 0;
+    if (have_queue) sysfs_queue_attr(dev, "optimal_io_size", &io_opt);
+
+    if (io_opt >= unit) unit = io_opt;
+    else if (max_kb * 1024 >= unit) unit = max_kb * 1024;
+
+    size_t chunk = CHUNK > unit ? CHUNK : unit;
+    if (!have_queue && chunk < 4 * unit) chunk = 4 * unit;
+    chunk = (chunk + unit - 1) / unit * unit;
+    if (chunk > AUTO_CHUNK_MAX && unit <= AUTO_CHUNK_MAX) chunk = AUTO_CHUNK_MAX / unit * unit;
+    return chunk;
+}
+
+/*
+ * Copy-on-write filesystems put every overwrite in fresh blocks and keep the
+ * old ones (in any snapshot that holds them, or until reused), so writing
+ * over a file there destroys nothing. Told apart by statfs() f_type.
+ */
+#define FS_BTRFS    0x9123683e
+#define FS_ZFS      0x2fc12fc1
+#define FS_BCACHEFS 0xca451a4e
+#define FS_NILFS    0x3434
+#define FS_XFS      0x58465342
+#define FS_OCFS2    0x7461636f
+
+/* name of a copy-on-write filesystem, or NULL for one that overwrites in place */
+static const char *cow_fs_name(long type, int fd) {
+    switch (type) {
+        case FS_BTRFS: {
+            /* chattr +C files (nodatacow) are overwritten in place, shared extents aside */
+            int flags;
+            if (fd >= 0 && ioctl(fd, FS_IOC_GETFLAGS, &flags) == 0 && (flags & FS_NOCOW_FL)) return NULL;
+            return "btrfs";
+        }
+        case FS_ZFS: return "zfs";
+        case FS_BCACHEFS: return "bcachefs";
+        case FS_NILFS: return "nilfs2";
+        default: return NULL;
+    }
+}
+
+/* filesystems whose files can share extents (reflink copies, dedupe, snapshots) */
+static bool fs_reflinks(long type) {
+    return type == FS_BTRFS || type == FS_XFS || type == FS_BCACHEFS || type == FS_OCFS2;
+}
+
+static atomic_bool cow_warned; /* the copy-on-write warning is printed once a run */
+
+/*
+ * -W auto: one writer per hardware queue (blk-mq exposes them as mq/<n>),
+ * at least 4 for single-queue SSDs whose firmware still runs commands in
+ * parallel, and just one on spinning disks, where stripes would only seek.
+ */
+#define AUTO_STRIPES_MAX 16
+
+static unsigned auto_stripes(dev_t dev) {
+    unsigned long rotational = 0;
+    if (sysfs_queue_attr(dev, "rotational", &rotational) == 0 && rotational) return 1;
+    char p[128];
+    snprintf(p, sizeof(p), "/sys/dev/block/%u:%u/mq", major(dev), minor(dev));
+    DIR *d = opendir(p);
+    if (!d) {
+        snprintf(p, sizeof(p), "/sys/dev/block/%u:%u/../mq", major(dev), minor(dev));
+        d = opendir(p);
+    }
+    unsigned n = 0;
+    if (d) {
+        struct dirent *de;
+        while ((de = readdir(d)) != NULL)
+            if (de->d_name[0] != '.') n++;
+        closedir(d);
+    }
+    if (n < 4) n = 4;
+    return n < AUTO_STRIPES_MAX ? n : AUTO_STRIPES_MAX;
+}
+
+/* pwrite() all of buf, retrying on EINTR and short writes */
+static int pwrite_full(int fd, const void *buf, size_t len, off_t off) {
+    const unsigned char *p = buf;
+    while (len) {
+        ssize_t w = pwrite(fd, p, len, off);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += w;
+        len -= (size_t)w;
+        off += w;
+    }
+    return 0;
+}
+
+/*
+ * Walks the extents in bufsize pieces from start_off, stopping at direct_end
+ * (the O_DIRECT tail is written separately). Every engine and the -P producer use it so they
+ * agree on the chunk sequence.
+ */
+struct chunk_iter {
+    size_t ext;
+    off_t pos;
+};
+
+static bool chunk_next(const struct shred_file *f, struct chunk_iter *it, off_t *off, size_t *len) {
+    while (it->ext < f->next) {
+        const struct extent *e = &f->ext[it->ext];
+        off_t end = e->end < f->direct_end ? e->end : f->direct_end;
+        if (it->pos < e->off) it->pos = e->off;
+        if (it->pos < f->start_off) it->pos = f->start_off;
+        if (it->pos < end) {
+            *off = it->pos;
+            *len = f->bufsize;
+            if ((off_t)*len > end - it->pos) *len = (size_t)(end - it->pos);
+            it->pos += (off_t)*len;
+            return true;
+        }
+        it->ext++;
+    }
+    return false;
+}
+
+/*
+ * Pattern passes write straight from prefilled buffers: buffer p holds the
+ * pattern starting at phase p, so a chunk at any offset has its bytes ready
+ * and nothing is filled per chunk. The buffers are filled once per file and
+ * pattern; a scheme repeating a pattern back to back, or a free-space filler
+ * going through its segments, reuses them as they are.
+ */
+static void pattern_fill(struct shred_file *f, const struct pass_spec *spec) {
+    if (f->pat_len == spec->len && memcmp(f->pat, spec->pattern, spec->len) == 0) return;
+    for (unsigned p = 0; p < spec->len; ++p)
+        pattern_expand(spec, p, f->pattern + (size_t)p * f->bufsize, f->bufsize);
+    f->pat_len = spec->len;
+    memcpy(f->pat, spec->pattern, spec->len);
+}
+
+/* the pattern bytes for a write at off */
+static const unsigned char *pattern_src(const struct shred_file *f, off_t off) {
+    return f->pattern + (size_t)(off % f->pat_len) * f->bufsize;
+}
+
+/*
+ * --sparse: only the allocated ranges (SEEK_DATA/SEEK_HOLE) are overwritten, so
+ * a mostly empty VM image costs its real size rather than its logical one.
+ * Falls back to the whole file if the filesystem cannot report holes.
+ */
+static void load_extents(struct shred_file *f) {
+    struct extent *ext = NULL;
+    size_t n = 0, cap = 0;
+    off_t pos = 0;
+    while (pos < f->size) {
+        off_t data = lseek(f->fd, pos, SEEK_DATA);
+        if (data < 0) {
+            if (errno == ENXIO) break; /* only a hole is left */
+            free(ext);
+            return;
+        }
+        off_t hole = lseek(f->fd, data, SEEK_HOLE);
+        if (hole < 0 || hole > f->size) hole = f->size;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 16;
+            struct extent *grown = realloc(ext, cap * sizeof(*ext));
+            if (!grown) {
+                free(ext);
+                return;
+            }
+            ext = grown;
+        }
+        ext[n].off = data;
+        ext[n].end = hole;
+        n++;
+        pos = hole;
+    }
+    f->ext = ext;
+    f->next = n;
+    f->data_bytes = 0;
+    for (size_t i = 0; i < n; ++i) f->data_bytes += ext[i].end - ext[i].off;
+}
+
+/*
+ * Extents that FIEMAP reports shared (reflink copies, deduplicated or in a
+ * snapshot) belong to another file too: a write to them is copied out to new
+ * blocks and the shared ones stay, still readable through the other owner.
+ * Drop them from f->ext so no pass is spent on them. Returns the bytes dropped.
+ */
+#define FIEMAP_BATCH 64
+
+static off_t exclude_shared(struct shred_file *f) {
+    uint64_t raw[(sizeof(struct fiemap) + FIEMAP_BATCH * sizeof(struct fiemap_extent)) / sizeof(uint64_t)];
+    struct fiemap *fm = (struct fiemap *)raw;
+    struct extent *shared = NULL;
+    size_t ns = 0, cap = 0;
+    uint64_t start = 0;
+    bool last = false;
+    while (!last && start < (uint64_t)f->size) {
+        memset(fm, 0, sizeof(*fm));
+        fm->fm_start = start;
+        fm->fm_length = (uint64_t)f->size - start;
+        fm->fm_extent_count = FIEMAP_BATCH;
+        if (ioctl(f->fd, FS_IOC_FIEMAP, fm) != 0 || fm->fm_mapped_extents == 0) break;
+        for (unsigned i = 0; i < fm->fm_mapped_extents; ++i) {
+            const struct fiemap_extent *e = &fm->fm_extents[i];
+            start = e->fe_logical + e->fe_length;
+            if (e->fe_flags & FIEMAP_EXTENT_LAST) last = true;
+            if (!(e->fe_flags & FIEMAP_EXTENT_SHARED)) continue;
+            off_t off = (off_t)e->fe_logical, end = start < (uint64_t)f->size ? (off_t)start : f->size;
+            if (ns && shared[ns - 1].end >= off) {
+                shared[ns - 1].end = end;
+                continue;
+            }
+            if (ns == cap) {
+                cap = cap ? cap * 2 : 16;
+                struct extent *grown = realloc(shared, cap * sizeof(*shared));
+                if (!grown) {
+                    free(shared);
+                    return 0;
+                }
+                shared = grown;
+            }
+            shared[ns++] = (struct extent){ off, end };
+        }
+    }
+    if (!ns) return 0;
+
+    /* each shared range splits at most one extent in two */
+    struct extent *out = malloc((f->next + ns) * sizeof(*out));
+    if (!out) {
+        free(shared);
+        return 0;
+    }
+    size_t n = 0, j = 0;
+    for (size_t i = 0; i < f->next; ++i) {
+        off_t pos = f->ext[i].off, end = f->ext[i].end;
+        while (j < ns && shared[j].end <= pos) ++j;
+        for (size_t k = j; k < ns && shared[k].off < end; ++k) {
+            if (shared[k].off > pos) out[n++] = (struct extent){ pos, shared[k].off };
+            if (shared[k].end > pos) pos = shared[k].end;
+        }
+        if (pos < end) out[n++] = (struct extent){ pos, end };
+    }
+    free(shared);
+    if (f->ext != &f->whole) free(f->ext);
+    off_t before = f->data_bytes;
+    f->ext = out;
+    f->next = n;
+    f->data_bytes = 0;
+    for (size_t i = 0; i < n; ++i) f->data_bytes += out[i].end - out[i].off;
+    return before - f->data_bytes;
+}
+
+/*
+ * After the last pass, deallocate whatever lies between the extents: those
+ * ranges read as zeros, but can still be backed by preallocated (unwritten)
+ * blocks holding old data.
+ */
+static void punch_holes(struct shred_file *f) {
+    off_t pos = 0;
+    for (size_t i = 0; i <= f->next; ++i) {
+        off_t end = i < f->next ? f->ext[i].off : f->size;
+        if (end > pos && fallocate(f->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, pos, end - pos) != 0)
+            return; /* not supported here; nothing more to gain */
+        if (i < f->next) pos = f->ext[i].end;
+    }
+}
+
+/* call only once [0, off) of pass has been synced */
+static void journal_checkpoint(struct shred_file *f, int pass, off_t off) {
+    struct timespec ts[2] = { { .tv_nsec = UTIME_OMIT }, f->jid.mtime };
+    futimens(f->fd, ts); /* best effort; only needed where there is no btime */
+    struct journal_rec r = { .id = f->jid, .pass = pass, .off = off };
+    char line[256];
+    journal_append(line, journal_format(line, sizeof(line), &r), true, f->o->verbose);
+}
+
+/* write engine: sync what this pass has written so far and checkpoint it */
+static void journal_midpass(struct shred_file *f, off_t end) {
+    f->checkpoint_at = end + journal.interval;
+    if (sync_and_check(f->fd) != 0) {
+        if (f->o->verbose) diag_errno("sync");
+        return;
+    }
+    journal_checkpoint(f, f->pass, end);
+}
+
+static void journal_done(struct shred_file *f) {
+    char line[64];
+    int n = snprintf(line, sizeof(line), "D %" PRIu64 " %" PRIu64 "\n", f->jid.dev, f->jid.ino);
+    journal_append(line, n, false, f->o->verbose);
+}
+
+/* pass_random() for one chunk of f, timed under --stats */
+static int chunk_random(struct shred_file *f, off_t off, void *buf, size_t len) {
+    double t0 = stat_clock();
+    int rc = pass_random(f->rng, &f->ks, off, buf, len);
+    stat_since(STAT_RNG, t0);
+    return rc;
+}
+
+/*
+ * O_DIRECT cannot write the partial block at the end of the file without
+ * extending it, so that tail goes through a buffered descriptor instead.
+ * The pass fdatasync on the main fd flushes it along with everything else.
+ */
+static int write_tail(struct shred_file *f, enum pass_kind kind, void *buf) {
+    bool verbose = f->o->verbose;
+    if (f->tail_fd < 0 || f->next == 0) return 0;
+    const struct extent *last = &f->ext[f->next - 1];
+    off_t off = last->off > f->direct_end ? last->off : f->direct_end;
+    if (last->end <= off) return 0; /* the tail is a hole */
+    size_t len = (size_t)(last->end - off);
+    if (kind == PASS_RANDOM && chunk_random(f, off, buf, len) != 0) {
+        if (verbose) fprintf(diag(), "random generation failed\n");
+        return -1;
+    }
+    throttle_take(len);
+    double t0 = write_clock();
+    if (pwrite_full(f->tail_fd, kind == PASS_PATTERN ? pattern_src(f, off) : buf, len, off) != 0) {
+        if (verbose) diag_errno("write(tail)");
+        return -1;
+    }
+    stat_since(STAT_WRITE, t0);
+    file_progress(f, len);
+    return 0;
+}
+
+/*
+ * Passes that skip fdatasync under -S still have to reach the disk, or the next
+ * pass would simply overwrite dirty pages in memory. Start writeback of each
+ * chunk as soon as it is written and wait for the chunk before it, so dirty
+ * pages stay bounded to about two chunks and only the device cache flush and
+ * metadata commit are saved for the synced passes.
+ */
+static void write_behind(struct shred_file *f, off_t off, size_t len) {
+    if (!f->write_behind || f->direct) return;
+    sync_file_range(f->fd, off, (off_t)len, SYNC_FILE_RANGE_WRITE);
+    off_t prev = off - (off_t)f->bufsize;
+    if (prev < 0) prev = 0;
+    if (prev < off)
+        sync_file_range(f->fd, prev, off - prev,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+}
+
+/* end of a write-behind pass: wait for whatever is still in flight, including the tail */
+static void write_behind_finish(struct shred_file *f) {
+    sync_file_range(f->fd, 0, 0,
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+}
+
+/*
+ * -P: filling a chunk and then writing it leaves the disk idle while the CPU
+ * works and vice versa. A producer thread fills a ring of buffers ahead of the
+ * writer, so a random pass takes max(RNG, I/O) rather than their sum.
+ */
+struct pipeline {
+    struct shred_file *f;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint64_t produced;          /* chunks filled */
+    uint64_t consumed;          /* chunks written */
+    bool failed;                /* producer could not generate random data */
+    bool stop;                  /* writer gave up */
+};
+
+static unsigned char *ring_slot(const struct shred_file *f, uint64_t k) {
+    return f->ring + (size_t)(k % f->ring_n) * f->bufsize;
+}
+
+static void *pipeline_producer(void *arg) {
+    struct pipeline *p = arg;
+    struct shred_file *f = p->f;
+    struct chunk_iter it = { 0 };
+    off_t off;
+    size_t len;
+    for (uint64_t k = 0; chunk_next(f, &it, &off, &len); ++k) {
+        pthread_mutex_lock(&p->lock);
+        while (!p->stop && p->produced - p->consumed >= f->ring_n) pthread_cond_wait(&p->cond, &p->lock);
+        bool stop = p->stop;
+        pthread_mutex_unlock(&p->lock);
+        if (stop) break;
+
+        int rc = chunk_random(f, off, ring_slot(f, k), len);
+
+        pthread_mutex_lock(&p->lock);
+        if (rc != 0) p->failed = true;
+        else p->produced++;
+        pthread_cond_broadcast(&p->cond);
+        pthread_mutex_unlock(&p->lock);
+        if (rc != 0) break;
+    }
+    return NULL;
+}
+
+/* returns 1 if the producer thread could not be started (caller runs unpipelined) */
+static int pipelined_pass(struct shred_file *f) {
+    bool verbose = f->o->verbose;
+    struct pipeline p = { .f = f };
+    pthread_t producer;
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.cond, NULL);
+    if (pthread_create(&producer, NULL, pipeline_producer, &p) != 0) {
+        pthread_mutex_destroy(&p.lock);
+        pthread_cond_destroy(&p.cond);
+        return 1;
+    }
+
+    int rc = 0;
+    struct chunk_iter it = { 0 };
+    off_t off;
+    size_t len;
+    for (uint64_t k = 0; rc == 0 && chunk_next(f, &it, &off, &len); ++k) {
+        pthread_mutex_lock(&p.lock);
+        while (p.produced <= k && !p.failed) pthread_cond_wait(&p.cond, &p.lock);
+        bool failed = p.produced <= k;
+        pthread_mutex_unlock(&p.lock);
+        if (failed) {
+            if (verbose) fprintf(diag(), "random generation failed\n");
+            rc = -1;
+            break;
+        }
+
+        throttle_take(len);
+        double t0 = write_clock();
+        if (shred_interrupted) {
+            f->interrupted = true;
+            rc = -1;
+        } else if (pwrite_full(f->fd, ring_slot(f, k), len, off) != 0) {
+            if (verbose) diag_errno("write");
+            rc = -1;
+        } else {
+            file_progress(f, len);
+            write_behind(f, off, len);
+            throttle_observe(t0, len);
+            stat_since(STAT_WRITE, t0);
+            f->frontier = off + (off_t)len;
+            if (f->journal && f->frontier >= f->checkpoint_at) journal_midpass(f, f->frontier);
+        }
+
+        pthread_mutex_lock(&p.lock);
+        p.consumed++;
+        pthread_cond_broadcast(&p.cond);
+        pthread_mutex_unlock(&p.lock);
+    }
+
+    pthread_mutex_lock(&p.lock);
+    p.stop = true;
+    pthread_cond_broadcast(&p.cond);
+    pthread_mutex_unlock(&p.lock);
+    pthread_join(producer, NULL);
+    pthread_mutex_destroy(&p.lock);
+    pthread_cond_destroy(&p.cond);
+    return rc;
+}
+
+/* blocking pwrite() loop over the whole file */
+static int write_pass(struct shred_file *f, enum pass_kind kind) {
+    bool verbose = f->o->verbose;
+    int rc = 1;
+    if (kind == PASS_ZERO) memset(f->buf, 0, f->bufsize);
+    if (kind == PASS_RANDOM && f->ring) rc = pipelined_pass(f);
+    if (rc < 0) return -1;
+    if (rc > 0) {
+        struct chunk_iter it = { 0 };
+        off_t off;
+        size_t len;
+        while (chunk_next(f, &it, &off, &len)) {
+            if (shred_interrupted) {
+                f->interrupted = true;
+                return -1;
+            }
+            if (kind == PASS_RANDOM && chunk_random(f, off, f->buf, len) != 0) {
+                if (verbose) fprintf(diag(), "random generation failed\n");
+                return -1;
+            }
+            throttle_take(len);
+            double t0 = write_clock();
+            if (pwrite_full(f->fd, kind == PASS_PATTERN ? pattern_src(f, off) : f->buf, len, off) != 0) {
+                if (verbose) diag_errno("write");
+                return -1;
+            }
+            file_progress(f, len);
+            write_behind(f, off, len);
+            throttle_observe(t0, len);
+            stat_since(STAT_WRITE, t0);
+            f->frontier = off + (off_t)len;
+            if (f->journal && f->frontier >= f->checkpoint_at) journal_midpass(f, f->frontier);
+        }
+    }
+    if (write_tail(f, kind, f->buf) != 0) return -1;
+    double t0 = now_sec();
+    if (f->write_behind) {
+        write_behind_finish(f);
+        f->sync_secs = now_sec() - t0;
+        return 0;
+    }
+    /* Ensure writes are flushed */
+    if (sync_and_check(f->fd) != 0) {
+        if (verbose) diag_errno("sync");
+        /* continue anyway, but warn */
+    } else {
+        f->synced = true;
+    }
+    f->sync_secs = now_sec() - t0;
+    return 0;
+}
+
+/*
+ * -e mmap: map the file MMAP_WINDOW bytes at a time and generate straight
+ * into the page cache, saving the copy write() makes out of the buffer.
+ * Writeback of each window starts as soon as it is filled, and the window
+ * before is waited for and dropped from the cache, so dirty and cached pages
+ * stay bounded to about two windows. A page not already cached is read in by
+ * the write fault before it is overwritten: this pays on files that are hot
+ * in the cache and costs a read pass on cold ones (see --bench).
+ */
+#define MMAP_WINDOW ((size_t)64 * 1024 * 1024)
+
+static int mmap_pass(struct shred_file *f, enum pass_kind kind) {
+    bool verbose = f->o->verbose;
+    off_t page = (off_t)sysconf(_SC_PAGESIZE);
+    off_t prev = 0, prev_len = 0;
+    for (size_t i = 0; i < f->next; ++i) {
+        off_t pos = f->ext[i].off > f->start_off ? f->ext[i].off : f->start_off, end = f->ext[i].end;
+        while (pos < end) {
+            off_t base = pos / page * page;
+            size_t wlen = end - base < (off_t)MMAP_WINDOW ? (size_t)(end - base) : MMAP_WINDOW;
+            unsigned char *map = mmap(NULL, wlen, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd, base);
+            if (map == MAP_FAILED) {
+                if (verbose) diag_errno("mmap");
+                return -1;
+            }
+            madvise(map, wlen, MADV_SEQUENTIAL);
+            off_t wend = base + (off_t)wlen;
+            for (off_t off = pos; off < wend; off += (off_t)f->bufsize) {
+                size_t len = wend - off < (off_t)f->bufsize ? (size_t)(wend - off) : f->bufsize;
+                unsigned char *dst = map + (off - base);
+                if (shred_interrupted) {
+                    f->interrupted = true;
+                    munmap(map, wlen);
+                    return -1;
+                }
+                throttle_take(len);
+                /* timed (f->buf set): stage the keystream so the write is the copy into the mapping alone */
+                const unsigned char *src = kind == PASS_PATTERN ? pattern_src(f, off) : f->buf;
+                if (kind == PASS_RANDOM && chunk_random(f, off, f->buf ? f->buf : dst, len) != 0) {
+                    if (verbose) fprintf(diag(), "random generation failed\n");
+                    munmap(map, wlen);
+                    return -1;
+                }
+                double t0 = write_clock();
+                if (kind == PASS_ZERO) memset(dst, 0, len);
+                else if (src) memcpy(dst, src, len);
+                file_progress(f, len);
+                throttle_observe(t0, len);
+                stat_since(STAT_WRITE, t0);
+                f->frontier = off + (off_t)len;
+                if (f->journal && f->frontier >= f->checkpoint_at) journal_midpass(f, f->frontier);
+            }
+            /* the pages were marked dirty on the write fault; munmap() does not write them */
+            munmap(map, wlen);
+            sync_file_range(f->fd, base, (off_t)wlen, SYNC_FILE_RANGE_WRITE);
+            if (prev_len) {
+                sync_file_range(f->fd, prev, prev_len,
+                                SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+                posix_fadvise(f->fd, prev, prev_len, POSIX_FADV_DONTNEED);
+            }
+            prev = base;
+            prev_len = (off_t)wlen;
+            pos = wend;
+        }
+    }
+    double t0 = now_sec();
+    if (f->write_behind) {
+        write_behind_finish(f);
+        f->sync_secs = now_sec() - t0;
+        return 0;
+    }
+    if (sync_and_check(f->fd) != 0) {
+        if (verbose) diag_errno("sync");
+    } else {
+        f->synced = true;
+    }
+    f->sync_secs = now_sec() - t0;
+    return 0;
+}
+
+#ifdef HAVE_IO_URING
+#define URING_FSYNC_TAG UINT64_MAX
+
+static void uring_queue_write(struct shred_file *f, unsigned slot) {
+    struct worker *w = f->w;
+    struct uring_slot *s = &w->slots[slot];
+    struct io_uring_sqe *sqe = uring_sqe(&w->ring);
+    const unsigned char *src = s->src ? s->src : w->bufs + (size_t)slot * w->bufsize;
+    sqe->opcode = w->bufs_registered && !s->src ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->fd = f->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(src + s->done);
+    sqe->len = (uint32_t)(s->len - s->done);
+    sqe->off = (uint64_t)(s->off + (off_t)s->done);
+    sqe->buf_index = (uint16_t)slot;
+    sqe->user_data = slot;
+}
+
+/*
+ * Keep up to queue_depth writes in flight, then queue an fdatasync with
+ * IOSQE_IO_DRAIN right behind the last write so the pass ends with a single
+ * wait instead of a separate blocking sync call. Write-behind passes end with
+ * a drained SYNC_FILE_RANGE that waits for writeback without the flush.
+ */
+static int uring_pass(struct shred_file *f, enum pass_kind kind) {
+    bool verbose = f->o->verbose;
+    struct worker *w = f->w;
+    unsigned free_slots[w->nbufs];
+    unsigned nfree = 0, inflight = 0;
+    bool sync_queued = false, sync_done = false, tail_done = false;
+    struct chunk_iter it = { 0 };
+    off_t coff;
+    size_t clen;
+    bool more = chunk_next(f, &it, &coff, &clen);
+    double sync_start = 0;      /* sync queued, or the last write before it done */
+    int rc = 0;
+
+    for (unsigned i = 0; i < w->nbufs; ++i) free_slots[nfree++] = w->nbufs - 1 - i;
+    if (kind == PASS_ZERO) memset(w->bufs, 0, (size_t)w->nbufs * w->bufsize);
+
+    while (inflight || !sync_done) {
+        if (rc == 0 && more && shred_interrupted) {
+            f->interrupted = true;
+            rc = -1;
+        }
+        while (rc == 0 && more && nfree) {
+            unsigned slot = free_slots[--nfree];
+            struct uring_slot *s = &w->slots[slot];
+            s->off = coff;
+            s->len = clen;
+            s->done = 0;
+            s->src = kind == PASS_PATTERN ? pattern_src(f, coff) : NULL;
+            if (kind == PASS_RANDOM &&
+                chunk_random(f, coff, w->bufs + (size_t)slot * w->bufsize, s->len) != 0) {
+                if (verbose) fprintf(diag(), "random generation failed\n");
+                free_slots[nfree++] = slot;
+                rc = -1;
+                break;
+            }
+            throttle_take(s->len);
+            s->t0 = write_clock();
+            uring_queue_write(f, slot);
+            more = chunk_next(f, &it, &coff, &clen);
+            inflight++;
+        }
+        if (rc == 0 && !more && !sync_queued) {
+            /* the unaligned O_DIRECT tail goes out synchronously through a spare slot */
+            if (!tail_done && nfree) {
+                if (write_tail(f, kind, w->bufs + (size_t)free_slots[nfree - 1] * w->bufsize) != 0) rc = -1;
+                tail_done = true;
+            }
+        }
+        if (rc == 0 && !more && !sync_queued && tail_done) {
+            struct io_uring_sqe *sqe = uring_sqe(&w->ring);
+            if (f->write_behind) {
+                sqe->opcode = IORING_OP_SYNC_FILE_RANGE;
+                sqe->sync_range_flags = SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                                        SYNC_FILE_RANGE_WAIT_AFTER;
+            } else {
+                sqe->opcode = IORING_OP_FSYNC;
+                sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+            }
+            sqe->fd = f->fd;
+            sqe->flags = IOSQE_IO_DRAIN;
+            sqe->user_data = URING_FSYNC_TAG;
+            sync_queued = true;
+            sync_start = now_sec();
+        }
+        if (rc != 0 && !sync_queued) sync_done = true; /* error before the sync was queued */
+        if (!inflight && sync_done) break;
+
+        if (uring_submit(&w->ring, 1) != 0) {
+            if (verbose) diag_errno("io_uring_enter");
+            worker_drop_ring(w);
+            return -1;
+        }
+        struct io_uring_cqe cqe;
+        while (uring_reap(&w->ring, &cqe)) {
+            if (cqe.user_data == URING_FSYNC_TAG) {
+                sync_done = true;
+                f->sync_secs = now_sec() - sync_start;
+                if (cqe.res < 0) {
+                    errno = -cqe.res;
+                    if (verbose) diag_errno("sync");
+                    /* continue anyway, but warn */
+                } else {
+                    f->synced = !f->write_behind;
+                }
+                continue;
+            }
+            unsigned slot = (unsigned)cqe.user_data;
+            struct uring_slot *s = &w->slots[slot];
+            if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+                uring_queue_write(f, slot);
+                continue;
+            }
+            if (cqe.res <= 0) {
+                if (rc == 0) {
+                    errno = cqe.res ? -cqe.res : EIO;
+                    if (verbose) diag_errno("write");
+                }
+                rc = -1;
+            } else {
+                s->done += (size_t)cqe.res;
+                file_progress(f, (uint64_t)cqe.res);
+                if (rc == 0 && s->done < s->len) {
+                    uring_queue_write(f, slot); /* short write: push the rest */
+                    continue;
+                }
+                if (rc == 0) write_behind(f, s->off, s->len);
+                throttle_observe(s->t0, s->len);
+                stat_since(STAT_WRITE, s->t0);
+            }
+            free_slots[nfree++] = slot;
+            inflight--;
+            if (sync_queued) sync_start = now_sec(); /* the drained sync starts after this */
+        }
+    }
+    return rc;
+}
+
+/*
+ * rename -> fsync(dir) as one linked submission, so the pair costs one
+ * io_uring_enter(); the unlink follows once the rename's result is known. A
+ * failed RENAMEAT does not reliably cancel what is linked behind it, and an
+ * unlink of newname after a rename that failed would remove whatever file
+ * already had that name. Names are relative to dirfd; sync_fd is the directory
+ * to fsync (or -1) and from/to are only used in messages. Returns the file's
+ * exit status, 1 if the rename itself failed (caller unlinks the original
+ * name), or -1 if the ring cannot take it or newname was taken, and the caller
+ * should fall back to plain syscalls.
+ */
+static int uring_rename_unlink(struct worker *w, int dirfd, const char *name, const char *newname,
+                               int sync_fd, const char *from, const char *to, bool verbose) {
+    struct uring *r = &w->ring;
+    if (!w->ring_ready || !r->has_renameat) return -1;
+
+    struct io_uring_sqe *sqe = uring_sqe(r);
+    sqe->opcode = IORING_OP_RENAMEAT;
+    sqe->fd = dirfd;
+    sqe->addr = (uint64_t)(uintptr_t)name;
+    sqe->len = (uint32_t)dirfd;
+    sqe->addr2 = (uint64_t)(uintptr_t)newname;
+    sqe->rename_flags = RENAME_NOREPLACE;
+    sqe->user_data = 0;
+    if (sync_fd >= 0) {
+        sqe->flags = IOSQE_IO_LINK;
+        sqe = uring_sqe(r);
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->fd = sync_fd;
+        sqe->user_data = 1;
+    }
+
+    unsigned want = sync_fd >= 0 ? 2 : 1, got = 0;
+    int res[2] = { -ECANCELED, 0 };
+    while (got < want) {
+        if (uring_submit(r, want - got) != 0) {
+            if (verbose) diag_errno("io_uring_enter");
+            worker_drop_ring(w);
+            return -1;
+        }
+        struct io_uring_cqe cqe;
+        while (uring_reap(r, &cqe)) {
+            res[cqe.user_data] = cqe.res;
+            got++;
+        }
+    }
+
+    /* newname already exists: rename_random() retries with fresh names */
+    if (res[0] == -EEXIST) return -1;
+    if (res[0] < 0) {
+        errno = -res[0];
+        if (verbose) diag_errno("rename");
+        return 1;
+    }
+    if (verbose) fprintf(diag(), "Renamed %s -> %s\n", from, to);
+    if (res[1] < 0) {
+        errno = -res[1];
+        if (verbose) diag_errno("fsync(dir)");
+    }
+    if (unlinkat(dirfd, newname, 0) != 0) {
+        if (verbose) diag_errno("unlink");
+        return 2;
+    }
+    if (verbose) fprintf(diag(), "Unlinked %s\n", to);
+    return 0;
+}
+#else
+static int uring_pass(struct shred_file *f, enum pass_kind kind) {
+    return write_pass(f, kind);
+}
+
+static int uring_rename_unlink(struct worker *w, int dirfd, const char *name, const char *newname,
+                               int sync_fd, const char *from, const char *to, bool verbose) {
+    (void)w; (void)dirfd; (void)name; (void)newname; (void)sync_fd; (void)from; (void)to; (void)verbose;
+    return -1;
+}
+#endif
+
+/*
+ * Block devices are split into nstripes contiguous ranges, each overwritten
+ * by its own thread through a copy of the shred_file that sees only its range,
+ * with its own buffer (or io_uring ring). One thread per stripe keeps every
+ * hardware queue busy where a single sequential writer would leave most of a
+ * large SSD idle. The keystream is addressed by offset, so all stripes share
+ * the pass key and the data matches a single-writer pass.
+ */
+struct stripe {
+    struct shred_file f;
+    struct worker w;            /* private ring; the file's worker belongs to its thread */
+    struct extent *ext;
+    bool use_uring;
+    enum pass_kind kind;
+    FILE *diag;
+    pthread_t tid;
+    int rc;
+};
+
+static void stripes_free(struct shred_file *f) {
+    for (unsigned i = 0; i < f->nstripes; ++i) {
+        struct stripe *s = &f->stripes[i];
+        worker_release(&s->w);
+        free(s->ext);
+    }
+    free(f->stripes);
+    f->stripes = NULL;
+    f->nstripes = 0;
+}
+
+/* split f into up to n stripes of whole buffers; leaves f unstriped if that gives fewer than two */
+static void stripes_setup(struct shred_file *f, unsigned n, bool use_uring) {
+    off_t unit = (off_t)f->bufsize;
+    off_t span = (f->size + (off_t)n - 1) / (off_t)n;
+    span = (span + unit - 1) / unit * unit;
+    if (span == 0 || span >= f->size) return;
+
+    f->stripes = calloc(n, sizeof(struct stripe));
+    if (!f->stripes) return;
+    for (unsigned i = 0; i < n && (off_t)i * span < f->size; ++i) {
+        struct stripe *s = &f->stripes[f->nstripes++];
+        off_t lo = (off_t)i * span, hi = lo + span < f->size ? lo + span : f->size;
+        s->f = *f;
+        s->f.stripes = NULL;
+        s->f.nstripes = 0;
+        s->f.ring = NULL;
+        s->f.journal = false; /* checkpoints are per pass, taken by the parent */
+        s->f.w = &s->w;
+        s->ext = alloc_buf(f->next * sizeof(struct extent));
+        if (!s->ext) {
+            stripes_free(f);
+            return;
+        }
+        s->f.ext = s->ext;
+        s->f.next = 0;
+        s->f.data_bytes = 0;
+        for (size_t e = 0; e < f->next; ++e) {
+            off_t a = f->ext[e].off > lo ? f->ext[e].off : lo;
+            off_t b = f->ext[e].end < hi ? f->ext[e].end : hi;
+            if (a >= b) continue;
+            s->ext[s->f.next++] = (struct extent){ a, b };
+            s->f.data_bytes += b - a;
+        }
+        s->use_uring = use_uring && worker_uring(&s->w, f->o, f->bufsize) == 0;
+    }
+}
+
+static void *stripe_main(void *arg) {
+    struct stripe *s = arg;
+    diag_stream = s->diag;
+    s->rc = s->use_uring ? uring_pass(&s->f, s->kind) : write_pass(&s->f, s->kind);
+    return NULL;
+}
+
+/* one pass with every stripe written concurrently, then a single device-wide sync */
+static int striped_pass(struct shred_file *f, enum pass_kind kind, bool sync) {
+    int rc = 0;
+    for (unsigned i = 0; i < f->nstripes; ++i) {
+        struct stripe *s = &f->stripes[i];
+        s->f.ks = f->ks;
+        s->f.rng = f->rng;
+        s->f.pattern = f->pattern;
+        s->f.pat_len = f->pat_len;
+        s->f.start_off = f->start_off;
+        s->f.write_behind = true; /* each stripe streams; the flush below covers all */
+        s->kind = kind;
+        s->diag = diag_stream;
+        if (pthread_create(&s->tid, NULL, stripe_main, s) != 0) {
+            s->tid = pthread_self();
+            stripe_main(s);
+        }
+    }
+    for (unsigned i = 0; i < f->nstripes; ++i) {
+        struct stripe *s = &f->stripes[i];
+        if (!pthread_equal(s->tid, pthread_self())) pthread_join(s->tid, NULL);
+        if (s->rc != 0) rc = -1;
+        explicit_bzero(&s->f.ks, sizeof(s->f.ks));
+    }
+    double t0 = now_sec();
+    if (rc == 0 && sync) {
+        if (sync_and_check(f->fd) == 0) f->synced = true;
+        else if (f->o->verbose) diag_errno("sync");
+    }
+    f->sync_secs = now_sec() - t0;
+    return rc;
+}
+
+/*
+ * The zero pass only hides that the file was shredded (the random passes have
+ * already replaced the contents), so it can be left to the storage stack:
+ * fallocate(FALLOC_FL_ZERO_RANGE) on files and BLKZEROOUT (WRITE ZEROES where
+ * the device has it) on block devices. Returns -1 if the zeros have to be
+ * written from userspace instead.
+ */
+static int zero_offload(struct shred_file *f) {
+    for (size_t i = 0; i < f->next; ++i) {
+        const struct extent *e = &f->ext[i];
+        int rc;
+        if (f->blkdev) {
+            /* BLKZEROOUT is real device I/O: under --max-rate, issue it a chunk at a time */
+            off_t step = throttle.on ? (off_t)f->bufsize : e->end - e->off;
+            rc = 0;
+            for (off_t off = e->off; rc == 0 && off < e->end; off += step) {
+                uint64_t range[2] = { (uint64_t)off, (uint64_t)(e->end - off < step ? e->end - off : step) };
+                throttle_take((size_t)range[1]);
+                rc = ioctl(f->fd, BLKZEROOUT, range);
+            }
+        } else {
+            rc = fallocate(f->fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE, e->off, e->end - e->off);
+        }
+        if (rc != 0) return -1;
+    }
+    if (f->o->verbose)
+        fprintf(diag(), "  zeroed with %s\n", f->blkdev ? "BLKZEROOUT" : "fallocate(ZERO_RANGE)");
+    file_progress(f, (uint64_t)f->data_bytes);
+    return 0;
+}
+
+static int run_pass(struct shred_file *f, const struct pass_spec *spec, bool use_uring, bool sync) {
+    enum pass_kind kind = spec->kind;
+    f->write_behind = !sync;
+    f->synced = false;
+    f->frontier = 0;
+    f->checkpoint_at = f->start_off + journal.interval;
+    double t_off = stat_clock();
+    if (kind == PASS_ZERO && f->o->zero_offload && zero_offload(f) == 0) {
+        stat_since(STAT_OFFLOAD, t_off);
+        double t0 = now_sec();
+        if (sync) {
+            if (sync_and_check(f->fd) == 0) f->synced = true;
+            else if (f->o->verbose) diag_errno("sync");
+        }
+        f->sync_secs = now_sec() - t0;
+        return 0;
+    }
+    if (kind == PASS_RANDOM && f->rng == RNG_CHACHA && keystream_seed(&f->ks) != 0) {
+        if (f->o->verbose) fprintf(diag(), "random seeding failed\n");
+        return -1;
+    }
+    if (kind == PASS_PATTERN) pattern_fill(f, spec);
+    if (f->nstripes) return striped_pass(f, kind, sync);
+    if (f->mapped) return mmap_pass(f, kind);
+    return use_uring ? uring_pass(f, kind) : write_pass(f, kind);
+}
+
+/* -S: does pass n (1-based, zero pass last) end in fdatasync? The last one always does. */
+static bool pass_syncs(const struct shred_opts *o, int n) {
+    int total = pass_count(o);
+    return n == total || (o->sync_every > 0 && n % o->sync_every == 0);
+}
+
+/* --bench samples: MiB/s of every pass and latency of every pass-ending fdatasync */
+struct bench_stats {
+    double *mib_s;
+    size_t npass;
+    double *sync_ms;
+    size_t nsync;
+    size_t cap;
+};
+
+static void bench_record(struct bench_stats *b, double mib_s, double sync_secs, bool sync) {
+    if (b->npass == b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 64;
+        double *a = realloc(b->mib_s, cap * sizeof(double));
+        if (a) b->mib_s = a;
+        double *c = a ? realloc(b->sync_ms, cap * sizeof(double)) : NULL;
+        if (c) b->sync_ms = c;
+        if (!a || !c) {
+            perror("realloc"); /* the sample is dropped */
+            return;
+        }
+        b->cap = cap;
+    }
+    b->mib_s[b->npass++] = mib_s;
+    if (sync) b->sync_ms[b->nsync++] = sync_secs * 1000.0;
+}
+
+/* run_pass() plus a timing line under -v, to check the chunk size choice */
+static int timed_pass(struct shred_file *f, const struct pass_spec *spec, bool use_uring, bool sync) {
+    struct bench_stats *bench = f->w->bench;
+    double t0 = (f->o->verbose || bench) ? now_sec() : 0;
+    int rc = run_pass(f, spec, use_uring, sync);
+    if (rc == 0 && sync) stat_secs(STAT_SYNC, f->sync_secs);
+    if (rc == 0 && (f->o->verbose || bench)) {
+        double dt = now_sec() - t0;
+        double mib = (double)f->data_bytes / (1024.0 * 1024.0);
+        if (f->o->verbose)
+            fprintf(diag(), "  %.1f MiB in %.3f s (%.1f MiB/s)\n", mib, dt, dt > 0 ? mib / dt : 0.0);
+        if (bench) bench_record(bench, dt > 0 ? mib / dt : 0.0, f->sync_secs, sync);
+    }
+    return rc;
+}
+
+/*
+ * --discard: hand the overwritten blocks back to the device so its garbage
+ * collection need not carry them. A file is punched in one hole over its
+ * whole size; the filesystem passes the freed blocks on when mounted with
+ * discard, otherwise the next fstrim does. A device gets BLKDISCARD (or
+ * BLKSECDISCARD) over its extents in DISCARD_BATCH ranges, so a signal is
+ * seen between them.
+ */
+#define DISCARD_BATCH ((off_t)1 << 30)
+
+static void discard_extents(int fd, bool blkdev, enum discard_mode mode, const struct extent *ext, size_t n,
+                            const char *path, bool verbose) {
+    double t0 = now_sec();
+    off_t bytes = 0;
+    const char *how = "fallocate(PUNCH_HOLE)";
+    if (!blkdev) {
+        off_t size = n ? ext[n - 1].end : 0;
+        if (size && fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, size) != 0) {
+            if (verbose) fprintf(diag(), "discard %s: fallocate(PUNCH_HOLE): %s\n", path, strerror(errno));
+            return;
+        }
+        bytes = size;
+    } else {
+        unsigned long req = mode == DISCARD_SECURE ? BLKSECDISCARD : BLKDISCARD;
+        how = mode == DISCARD_SECURE ? "BLKSECDISCARD" : "BLKDISCARD";
+        for (size_t i = 0; i < n && !shred_interrupted; ++i) {
+            for (off_t off = ext[i].off; off < ext[i].end && !shred_interrupted;) {
+                uint64_t range[2] = { (uint64_t)off, (uint64_t)(ext[i].end - off < DISCARD_BATCH ? ext[i].end - off
+                                                                                                  : DISCARD_BATCH) };
+                if (ioctl(fd, req, range) != 0) {
+                    if (req == BLKSECDISCARD && (errno == EOPNOTSUPP || errno == EINVAL)) {
+                        /* most SSDs have no secure discard; a plain one still frees the blocks */
+                        if (verbose) fprintf(diag(), "BLKSECDISCARD not supported on %s, using BLKDISCARD\n", path);
+                        req = BLKDISCARD;
+                        how = "BLKDISCARD";
+                        continue;
+                    }
+                    if (verbose) fprintf(diag(), "discard %s: %s: %s\n", path, how, strerror(errno));
+                    return;
+                }
+                off += (off_t)range[1];
+                bytes += (off_t)range[1];
+            }
+        }
+    }
+    stat_since(STAT_DISCARD, t0);
+    if (verbose)
+        fprintf(diag(), "Discarded %.1f MiB of %s with %s in %.3f s\n", (double)bytes / (1024.0 * 1024.0), path,
+                how, now_sec() - t0);
+}
+
+/*
+ * --verify: read the last pass back and compare it with what was written, to
+ * catch devices and stacks that acknowledge writes they never persisted. The
+ * reads use O_DIRECT, through a fresh descriptor, so the page cache cannot
+ * answer them. The worker checks the file before it renames anything: a
+ * mismatch or read error fails the file, which keeps its name and its blocks
+ * (no --discard), and makes the exit status 2. With -j the other workers go on
+ * writing meanwhile.
+ */
+struct verify_job {
+    int fd;
+    bool direct;
+    struct pass_spec spec;      /* the last pass */
+    struct keystream ks;        /* PASS_RANDOM: its key */
+    const struct extent *ext;
+    size_t next;
+    off_t from;                 /* only [from, end) of the extents is checked */
+    off_t data_bytes;
+    size_t align, bufsize;
+    const char *path;
+    bool verbose;
+};
+
+static atomic_size_t verify_failures;
+
+typedef uint64_t scan_vec __attribute__((vector_size(32)));
+
+/* length of the all-zero prefix of p, checked 128 bytes at a time (same clones as the keystream) */
+CHACHA_TARGETS
+static size_t zero_prefix(const unsigned char *p, size_t n) {
+    size_t i = 0;
+    for (; i + 128 <= n; i += 128) {
+        scan_vec v[4];
+        memcpy(v, p + i, sizeof(v));
+        scan_vec acc = v[0] | v[1] | v[2] | v[3];
+        if (acc[0] | acc[1] | acc[2] | acc[3]) break;
+    }
+    while (i < n && p[i] == 0) i++;
+    return i;
+}
+
+/* 0 if the file holds the expected bytes; otherwise -1 with *bad set to the first wrong offset, or -1 */
+static int verify_extents(struct arena *arena, const struct verify_job *j, off_t *bad) {
+    unsigned char *buf = arena_get(arena, 2 * j->bufsize);
+    *bad = -1;
+    if (!buf) {
+        errno = ENOMEM;
+        return -1;
+    }
+    unsigned char *want = buf + j->bufsize;
+    for (size_t i = 0; i < j->next; ++i) {
+        if (j->ext[i].end <= j->from) continue;
+        off_t first = j->ext[i].off > j->from ? j->ext[i].off : j->from;
+        off_t pos = first / (off_t)j->align * (off_t)j->align;
+        while (pos < j->ext[i].end) {
+            ssize_t got = pread(j->fd, buf, j->bufsize, pos);
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) {
+                if (got == 0) errno = EIO; /* shorter than when it was written */
+                return -1;
+            }
+            off_t lo = pos > first ? pos : first;
+            off_t hi = pos + got < j->ext[i].end ? pos + got : j->ext[i].end;
+            const unsigned char *have = buf + (lo - pos);
+            size_t len = (size_t)(hi - lo), ok;
+            if (j->spec.kind == PASS_ZERO) {
+                ok = zero_prefix(have, len);
+            } else {
+                if (j->spec.kind == PASS_RANDOM) keystream_fill(&j->ks, (uint64_t)lo, want, len);
+                else pattern_expand(&j->spec, lo, want, len);
+                ok = memcmp(have, want, len) == 0 ? len : 0;
+                while (ok < len && have[ok] == want[ok]) ok++;
+            }
+            if (ok < len) {
+                *bad = lo + (off_t)ok;
+                return -1;
+            }
+            pos += got;
+        }
+    }
+    return 0;
+}
+
+/* check f's last pass from offset from on; 0 if it reads back as written */
+static int verify_file(struct shred_file *f, const struct pass_spec *spec, off_t from, size_t align) {
+    bool verbose = f->o->verbose;
+    /* reopen the inode itself, with O_DIRECT where the filesystem allows it */
+    char proc[64];
+    snprintf(proc, sizeof(proc), "/proc/self/fd/%d", f->fd);
+    bool direct = true;
+    int fd = open(proc, O_RDONLY | O_CLOEXEC | O_DIRECT);
+    if (fd < 0 && errno == EINVAL) {
+        direct = false;
+        fd = open(proc, O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0) {
+        atomic_fetch_add(&verify_failures, 1);
+        fprintf(diag(), "Verification failed for %s: open: %s\n", f->path, strerror(errno));
+        return -1;
+    }
+    /* buffered fallback: the pass was synced, so its clean pages can be dropped */
+    if (!direct) posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    if (!direct) align = 1;
+
+    struct verify_job j = {
+        .fd = fd,
+        .direct = direct,
+        .spec = *spec,
+        .ks = f->ks,
+        .ext = f->ext,
+        .next = f->next,
+        .from = from,
+        .align = align,
+        .bufsize = (f->bufsize + align - 1) / align * align,
+        .path = f->path,
+        .verbose = verbose,
+    };
+    for (size_t i = 0; i < f->next; ++i) {
+        if (f->ext[i].end > from) j.data_bytes += f->ext[i].end - (f->ext[i].off > from ? f->ext[i].off : from);
+    }
+
+    double t0 = now_sec();
+    off_t bad;
+    int rc = verify_extents(&f->w->verify_arena, &j, &bad);
+    stat_since(STAT_VERIFY, t0);
+    if (rc != 0) {
+        atomic_fetch_add(&verify_failures, 1);
+        if (bad >= 0)
+            fprintf(diag(), "Verification failed for %s: wrong data at offset %" PRId64 "\n", j.path, (int64_t)bad);
+        else
+            fprintf(diag(), "Verification failed for %s: read: %s\n", j.path, strerror(errno));
+    } else if (verbose) {
+        double dt = now_sec() - t0, mib = (double)j.data_bytes / (1024.0 * 1024.0);
+        fprintf(diag(), "Verified %s: %.1f MiB in %.3f s (%.1f MiB/s%s)\n", j.path, mib, dt,
+                dt > 0 ? mib / dt : 0.0, j.direct ? "" : ", page cache dropped");
+    }
+    explicit_bzero(&j.ks, sizeof(j.ks));
+    close(fd);
+    return rc;
+}
+
+/*
+ * Overwrite dirfd/name according to the options. at_flags is 0 for paths from
+ * the command line (symlinks followed, as stat() would) and AT_SYMLINK_NOFOLLOW
+ * for entries found by the -r walker. path is only used in messages. Returns
+ * -1 on failure, 0 for a regular file and 1 for a block device, which callers
+ * leave in place instead of renaming it.
+ */
+static int overwrite_file(int dirfd, const char *name, const char *path, int at_flags,
+                          const struct shred_opts *o, struct worker *w) {
+    bool verbose = o->verbose;
+    double t_open = stat_clock();
+    /*
+     * Entries from the walker were DT_REG a moment ago: open them straight
+     * away and fstat() the fd (O_NONBLOCK in case a FIFO took the name
+     * meanwhile). Command-line paths are stat()ed first, since a block device
+     * must be opened O_EXCL (EBUSY while mounted or otherwise claimed).
+     */
+    bool walked = at_flags & AT_SYMLINK_NOFOLLOW;
+    int open_flags = O_WRONLY | O_CLOEXEC | O_NOCTTY | (walked ? O_NOFOLLOW | O_NONBLOCK : 0);
+    struct stat st;
+    if (!walked && fstatat(dirfd, name, &st, at_flags) != 0) {
+        if (verbose) diag_errno("stat");
+        return -1;
+    }
+    /* block devices only when named explicitly, never found by the walker */
+    bool blkdev = !walked && S_ISBLK(st.st_mode);
+    if (!walked && !S_ISREG(st.st_mode) && !blkdev) {
+        if (verbose) fprintf(diag(), "skipping non-regular file: %s\n", path);
+        return -1;
+    }
+    if (blkdev) open_flags |= O_EXCL;
+    /* a shared mapping needs read access too; devices keep to write() */
+    bool mapped = o->engine == ENGINE_MMAP && !blkdev;
+    if (mapped) open_flags = (open_flags & ~O_ACCMODE) | O_RDWR;
+
+    bool direct = o->direct && !mapped;
+    int fd = openat(dirfd, name, open_flags | (direct ? O_DIRECT : 0));
+    if (fd < 0 && direct && errno == EINVAL) {
+        /* filesystem without O_DIRECT support */
+        if (verbose) fprintf(diag(), "O_DIRECT not supported for %s, using page cache\n", path);
+        direct = false;
+        fd = openat(dirfd, name, open_flags);
+    }
+    if (fd < 0) {
+        if (verbose) diag_errno("open");
+        return -1;
+    }
+    if (walked && (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))) {
+        if (verbose) fprintf(diag(), "skipping non-regular file: %s\n", path);
+        close(fd);
+        return -1;
+    }
+    /* checked on what was opened, so a name swapped since the daemon's check gains nothing */
+    struct stat own;
+    if (w->owner && (fstat(fd, &own) != 0 || own.st_uid != w->owner)) {
+        fprintf(diag(), "%s: not owned by uid %u\n", path, (unsigned)w->owner);
+        close(fd);
+        return -1;
+    }
+    if (blkdev) {
+        uint64_t bytes;
+        if (ioctl(fd, BLKGETSIZE64, &bytes) != 0) {
+            if (verbose) diag_errno("ioctl(BLKGETSIZE64)");
+            close(fd);
+            return -1;
+        }
+        st.st_size = (off_t)bytes;
+    }
+
+    struct shred_file f = {
+        .path = path,
+        .o = o,
+        .w = w,
+        .fd = fd,
+        .size = st.st_size,
+        .direct = direct,
+        .direct_end = st.st_size,
+        .tail_fd = -1,
+        .blkdev = blkdev,
+        .mapped = mapped,
+        .whole = { 0, st.st_size },
+        .data_bytes = st.st_size,
+    };
+    f.ext = &f.whole;
+    f.next = 1;
+    if (o->sparse) {
+        load_extents(&f);
+        if (verbose)
+            fprintf(diag(), "%zu data extent%s, %" PRId64 " of %" PRId64 " bytes allocated in %s\n",
+                    f.next, f.next == 1 ? "" : "s", (int64_t)f.data_bytes, (int64_t)f.size, path);
+    }
+    /* Use a moderate chunk buffer */
+    off_t size = f.size;
+    /* the sysfs lookups behind these cost more than a small file's write; cache them per device */
+    dev_t dev = blkdev ? st.st_rdev : st.st_dev;
+    if (!w->geom_valid || w->geom_dev != dev) {
+        struct statfs sf;
+        w->geom_dev = dev;
+        w->geom_align = dio_alignment(&st);
+        w->geom_chunk = auto_chunk(&st);
+        w->geom_fs = !blkdev && fstatfs(fd, &sf) == 0 ? (long)sf.f_type : 0;
+        w->geom_valid = true;
+    }
+    const char *cow = blkdev || o->cow == COW_FORCE ? NULL : cow_fs_name(w->geom_fs, fd);
+    if (cow && o->cow == COW_SKIP) {
+        fprintf(diag(), "skipping %s: %s is copy-on-write, overwriting would leave the old blocks\n", path, cow);
+        if (f.ext != &f.whole) free(f.ext);
+        close(fd);
+        return -1;
+    }
+    if (cow && !atomic_exchange(&cow_warned, true))
+        fprintf(diag(), "warning: %s is copy-on-write: overwrites go to new blocks and the old contents stay "
+                        "on disk (and in snapshots); --free-space afterwards reaches some of them\n", cow);
+    if (!blkdev && fs_reflinks(w->geom_fs)) {
+        off_t shared = exclude_shared(&f);
+        if (shared && verbose)
+            fprintf(diag(), "%" PRId64 " bytes of %s are shared with other files (reflinks, snapshots); "
+                            "not overwriting them\n", (int64_t)shared, path);
+    }
+    size_t align = direct ? w->geom_align : 1;
+    size_t chunk = o->chunk ? o->chunk : w->geom_chunk;
+    chunk = (chunk + align - 1) / align * align;
+    if (verbose) fprintf(diag(), "Chunk size %zu KiB for %s%s\n", chunk / 1024, path, o->chunk ? "" : " (auto)");
+    f.bufsize = (chunk < (size_t)size) ? chunk : (size_t)size ? (size_t)size : chunk;
+
+    if (direct) {
+        f.bufsize = (f.bufsize + align - 1) / align * align;
+        f.direct_end = size / (off_t)align * (off_t)align;
+        if (f.direct_end < size) {
+            f.tail_fd = openat(dirfd, name, open_flags);
+            if (f.tail_fd < 0) {
+                if (verbose) diag_errno("open");
+                close(fd);
+                return -1;
+            }
+        }
+    }
+
+    int npasses = pass_count(o), first_pass = 1;
+    if (journal.fd >= 0 && f.data_bytes >= journal.interval) {
+        f.journal = true;
+        journal_identify(fd, &st, f.size, &f.jid);
+        struct journal_rec rec;
+        if (journal_lookup(&f.jid, &rec)) {
+            f.jid = rec.id; /* keep the mtime from before the first run */
+            first_pass = rec.pass < npasses + 1 ? rec.pass : npasses + 1;
+            f.start_off = first_pass <= npasses ? rec.off / (off_t)align * (off_t)align : 0;
+            if (verbose)
+                fprintf(diag(), "Resuming %s at pass %d, offset %" PRId64 "\n", path, first_pass,
+                        (int64_t)f.start_off);
+        }
+    }
+
+    if (progress_on() || o->progress) {
+        /* passes finished in an earlier run come off the total */
+        int64_t skipped = (int64_t)f.data_bytes * (first_pass - 1);
+        for (size_t i = 0; i < f.next && f.ext[i].off < f.start_off; ++i)
+            skipped += (f.ext[i].end < f.start_off ? f.ext[i].end : f.start_off) - f.ext[i].off;
+        int64_t total = (int64_t)f.data_bytes * npasses - skipped;
+        f.progress_total = (uint64_t)total;
+        if (progress_on()) {
+            if (!w->prog) w->prog = progress_claim();
+            f.prog = w->prog;
+            if (f.prog) progress_begin(f.prog, path, (uint64_t)total);
+            if (total != (int64_t)f.size * npasses)
+                atomic_fetch_add(&progress.total, total - (int64_t)f.size * npasses);
+        }
+    }
+
+    if (blkdev) {
+        unsigned n = o->stripes ? o->stripes : auto_stripes(st.st_rdev);
+        if (n > 1) stripes_setup(&f, n, o->engine == ENGINE_URING);
+        if (verbose)
+            fprintf(diag(), "Block device %s: %" PRId64 " bytes, %u writer%s\n", path, (int64_t)f.size,
+                    f.nstripes ? f.nstripes : 1, f.nstripes > 1 ? "s" : "");
+    }
+
+    bool use_uring = !f.nstripes && o->engine == ENGINE_URING && worker_uring(w, o, chunk) == 0;
+    /* io_uring would fail O_NONBLOCK writes with EAGAIN instead of waiting */
+    if (use_uring && walked) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    /* a pipeline only pays off with more than one chunk to overlap */
+    if (!use_uring && !mapped && !f.nstripes && o->pipeline >= 2 && f.data_bytes > (off_t)f.bufsize)
+        f.ring_n = o->pipeline;
+
+    /*
+     * Carve f.buf, the ring and the stripes' buffers out of the worker's arena.
+     * Sizing it by whole chunks rather than this file keeps one mapping across
+     * a mix of file sizes.
+     */
+    unsigned stripe_bufs = 0;
+    for (unsigned i = 0; i < f.nstripes; ++i) stripe_bufs += f.stripes[i].use_uring ? 0 : 1;
+    /* -e mmap generates straight into the mapping, unless --stats/--adaptive time the writes apart */
+    bool own_buf = !use_uring && (!mapped || write_timed);
+    size_t nbufs = (own_buf ? 1 : 0) + f.ring_n + stripe_bufs + o->pattern_max;
+    unsigned char *bufs = nbufs ? arena_get(&w->arena, nbufs * (chunk > f.bufsize ? chunk : f.bufsize)) : NULL;
+    int rc = nbufs && !bufs ? -1 : 0;
+    if (bufs) {
+        if (own_buf) {
+            f.buf = bufs;
+            bufs += f.bufsize;
+        }
+        if (f.ring_n) {
+            f.ring = bufs;
+            bufs += (size_t)f.ring_n * f.bufsize;
+        }
+        for (unsigned i = 0; i < f.nstripes; ++i) {
+            if (f.stripes[i].use_uring) continue;
+            f.stripes[i].f.buf = bufs;
+            bufs += f.bufsize;
+        }
+        if (o->pattern_max) f.pattern = bufs;
+    }
+
+    off_t resumed_off = f.start_off;
+    stat_since(STAT_OPEN, t_open);
+    double t_passes = stat_clock();
+    for (int pass = first_pass; pass <= npasses && rc == 0; ++pass) {
+        struct pass_spec spec = pass_at(o, pass);
+        if (verbose) {
+            char hex[2 * PATTERN_MAX + 1];
+            if (pass > npasses - (o->final_zero ? 1 : 0))
+                fprintf(diag(), "Final zero pass for %s\n", path);
+            else
+                fprintf(diag(), "Pass %d/%d (%s) for %s\n", pass, npasses - (o->final_zero ? 1 : 0),
+                        pass_name(&spec, hex), path);
+        }
+        f.pass = pass;
+        /* getrandom() output cannot be reproduced for --verify; a last random pass uses a keystream */
+        f.rng = o->verify && pass == npasses ? RNG_CHACHA : o->rng;
+        rc = timed_pass(&f, &spec, use_uring, pass_syncs(o, pass));
+        if (rc == 0 && f.journal && f.synced) journal_checkpoint(&f, pass + 1, 0);
+        f.start_off = 0;
+    }
+    if (rc == 0 && stats.on && first_pass <= npasses) {
+        double secs = now_sec() - t_passes;
+        if (secs > 0) stat_add(STAT_FILE_RATE, (uint64_t)((double)f.data_bytes * (npasses - first_pass + 1) / secs));
+    }
+
+    if (rc == 0 && o->sparse) punch_holes(&f);
+    /*
+     * A last pass resumed from the journal was partly written with an earlier
+     * run's key: a random one is only checked from where this run started.
+     */
+    struct pass_spec last = pass_at(o, npasses);
+    if (rc == 0 && o->verify && first_pass <= npasses)
+        rc = verify_file(&f, &last, first_pass == npasses && last.kind == PASS_RANDOM ? resumed_off : 0,
+                         w->geom_align);
+    if (f.journal) {
+        if (rc == 0) journal_done(&f);
+        /* stopped by a signal: keep what the write engine got through */
+        else if (f.interrupted && f.frontier + journal.interval > f.checkpoint_at && sync_and_check(fd) == 0)
+            journal_checkpoint(&f, f.pass, f.frontier);
+    }
+
+    if (rc == 0 && o->discard)
+        discard_extents(fd, blkdev, o->discard, f.ext, f.next, path, verbose);
+
+    explicit_bzero(&f.ks, sizeof(f.ks));
+    if (f.prog) progress_end(f.prog);
+    stripes_free(&f);
+    if (f.ext != &f.whole) free(f.ext);
+    if (f.tail_fd >= 0) close(f.tail_fd);
+    if (close(fd) != 0 && verbose) diag_errno("close");
+    return rc == 0 && blkdev ? 1 : rc;
+}
+
+/*
+ * Rename dirfd/name to a random name, fsync the directory (sync_fd, if >= 0)
+ * and unlink the new name. Messages show from, and the new name after the
+ * first prefix_len bytes of from (its directory part). If the rename fails,
+ * the original name is unlinked instead. Returns the exit status for the file.
+ */
+static int rename_and_unlink(int dirfd, const char *name, int sync_fd, const char *from, int prefix_len,
+                             const struct shred_opts *o, struct worker *w) {
+    bool verbose = o->verbose;
+    char newname[RANDOM_NAME_LEN + 1], to[PATH_MAX] = "";
+    bool try_rename = true;
+    if (o->engine == ENGINE_URING && random_name(newname) == 0) {
+        if (verbose) snprintf(to, sizeof(to), "%.*s%s", prefix_len, from, newname);
+        double t0 = stat_clock();
+        int status = uring_rename_unlink(w, dirfd, name, newname, sync_fd, from, to, verbose);
+        if (status == 0) stat_since(STAT_URING_META, t0);
+        if (status == 1) try_rename = false; /* rename failed: unlink original below */
+        else if (status != -1) return status;
+    }
+    if (try_rename) {
+        double t0 = stat_clock();
+        if (rename_random(dirfd, name, newname) != 0) {
+            if (verbose) diag_errno("rename");
+        } else {
+            stat_since(STAT_RENAME, t0);
+            if (verbose) {
+                snprintf(to, sizeof(to), "%.*s%s", prefix_len, from, newname);
+                fprintf(diag(), "Renamed %s -> %s\n", from, to);
+            }
+            /* fsync the directory to persist rename */
+            t0 = stat_clock();
+            if (sync_fd >= 0) {
+                if (fsync(sync_fd) != 0 && verbose) diag_errno("fsync(dir)");
+                stat_since(STAT_DIR_FSYNC, t0);
+            }
+            /* unlink new name below */
+            t0 = stat_clock();
+            if (unlinkat(dirfd, newname, 0) != 0) {
+                if (verbose) diag_errno("unlink");
+                return 2;
+            }
+            stat_since(STAT_UNLINK, t0);
+            if (verbose) fprintf(diag(), "Unlinked %s\n", to);
+            return 0;
+        }
+    }
+
+    /* If rename failed or not used, unlink original path */
+    double t0 = stat_clock();
+    if (unlinkat(dirfd, name, 0) != 0) {
+        if (verbose) diag_errno("unlink");
+        return 2;
+    }
+    stat_since(STAT_UNLINK, t0);
+    if (verbose) fprintf(diag(), "Unlinked %s\n", from);
+    return 0;
+}
+
+/*
+ * Command-line and --files-from paths are renamed as they finish and unlinked
+ * PATH_BATCH at a time, behind one fsync() of their directory, as -r does per
+ * getdents64() block. The batch is flushed when the worker moves to another
+ * directory, when it is full and before the worker goes idle. Daemon and
+ * library requests are not batched: their answer means the name is gone.
+ */
+#define PATH_BATCH 256
+
+static void worker_flush(struct worker *w, bool verbose) {
+    if (w->nrenamed == 0) return;
+    const char *dir = w->dir_key_len ? w->dir_key : "./";
+    double t0 = stat_clock();
+    if (fsync(w->dir_fd) != 0 && verbose) diag_errno("fsync(dir)");
+    stat_since(STAT_DIR_FSYNC, t0);
+    for (unsigned i = 0; i < w->nrenamed; ++i) {
+        t0 = stat_clock();
+        if (unlinkat(w->dir_fd, w->renamed[i], 0) != 0) {
+            fprintf(diag(), "unlink %.*s%s: %s\n", (int)w->dir_key_len, w->dir_key, w->renamed[i], strerror(errno));
+            w->flush_failed = true;
+        } else {
+            stat_since(STAT_UNLINK, t0);
+        }
+    }
+    if (verbose) fprintf(diag(), "Unlinked %u files in %s\n", w->nrenamed, dir);
+    w->nrenamed = 0;
+}
+
+/*
+ * Command-line paths are shredded relative to their directory, opened once
+ * and kept by the worker while consecutive paths (a glob, an xargs stream)
+ * share it. A long-lived worker (the daemon's, the library's) may see the
+ * directory replaced or the process chdir() in between, so a hit is only
+ * taken if the prefix still names the same inode. Sets *name to the last
+ * component and *prefix_len to the length of the directory part including
+ * its slash. Returns the directory fd, or -1 to use the path as given.
+ */
+static int worker_dir(struct worker *w, const char *path, bool verbose, const char **name, int *prefix_len) {
+    const char *slash = strrchr(path, '/');
+    size_t len = slash ? (size_t)(slash - path) + 1 : 0;
+    *name = path + len;
+    *prefix_len = (int)len;
+    if (**name == '\0' || len >= PATH_MAX) return -1;
+
+    char dir[PATH_MAX];
+    if (len == 0) strcpy(dir, ".");
+    else {
+        memcpy(dir, path, len);
+        dir[len] = '\0';
+    }
+    struct stat st;
+    if (w->dir_open && w->dir_key_len == len && memcmp(w->dir_key, path, len) == 0 && stat(dir, &st) == 0 &&
+        st.st_dev == w->dir_dev && st.st_ino == w->dir_ino)
+        return w->dir_fd;
+
+    int fd = open(dir, O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    if (w->dir_open) {
+        worker_flush(w, verbose);
+        close(w->dir_fd);
+    }
+    w->dir_fd = fd;
+    w->dir_dev = st.st_dev;
+    w->dir_ino = st.st_ino;
+    w->dir_open = true;
+    memcpy(w->dir_key, path, len);
+    w->dir_key_len = len;
+    return fd;
+}
+
+/*
+ * overwrite, rename and unlink one path; returns the exit status for it. With
+ * batch set, the unlink is left to worker_flush().
+ */
+static int shred_path(const char *path, bool batch, const struct shred_opts *o, struct worker *w) {
+    bool verbose = o->verbose;
+    if (shred_interrupted) return 2; /* --journal: leave the rest for the next run */
+    if (verbose) fprintf(diag(), "Processing %s\n", path);
+    double t0 = stat_clock();
+
+    const char *name;
+    int prefix_len;
+    int dfd = worker_dir(w, path, verbose, &name, &prefix_len);
+    int dirfd = dfd >= 0 ? dfd : AT_FDCWD;
+    if (dfd < 0) name = path;
+
+    int kind = overwrite_file(dirfd, name, path, 0, o, w);
+    if (kind < 0) {
+        fprintf(diag(), "Failed to securely overwrite %s\n", path);
+        return 2;
+    }
+
+    /* a device node keeps its name: there is nothing behind it left to hide */
+    if (kind == 1) {
+        if (verbose) fprintf(diag(), "Wiped block device %s\n", path);
+        stat_since(STAT_FILE, t0);
+        return 0;
+    }
+    /* --daemon: nor may the client have a name that is not its own removed */
+    struct stat st;
+    if (w->owner && (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0 || st.st_uid != w->owner)) {
+        fprintf(diag(), "%s: name not owned by uid %u, left in place\n", path, (unsigned)w->owner);
+        return 2;
+    }
+
+    if (batch && dfd >= 0 && (w->renamed || (w->renamed = alloc_buf(PATH_BATCH * sizeof(*w->renamed))))) {
+        if (w->nrenamed == PATH_BATCH) worker_flush(w, verbose);
+        char *newname = w->renamed[w->nrenamed];
+        double t1 = stat_clock();
+        if (rename_random(dfd, name, newname) == 0) {
+            w->nrenamed++;
+            stat_since(STAT_RENAME, t1);
+            stat_since(STAT_FILE, t0);
+            if (verbose) fprintf(diag(), "Renamed %s -> %.*s%s\n", path, prefix_len, path, newname);
+            return 0;
+        }
+        if (verbose) diag_errno("rename");
+        if (unlinkat(dfd, name, 0) != 0) {
+            if (verbose) diag_errno("unlink");
+            return 2;
+        }
+        if (verbose) fprintf(diag(), "Unlinked %s\n", path);
+        return 0;
+    }
+
+    int status = rename_and_unlink(dirfd, name, dfd, path, prefix_len, o, w);
+    if (status == 0) stat_since(STAT_FILE, t0);
+    return status;
+}
+
+/*
+ * --daemon FD request: overwrite the file behind a descriptor a client passed.
+ * It is reopened through /proc for the flags overwrite_file() wants, and not
+ * renamed or unlinked: the name, if it still has one, is the client's.
+ */
+static int shred_fd(int fd, const char *path, const struct shred_opts *o, struct worker *w) {
+    if (o->verbose) fprintf(diag(), "Processing %s\n", path);
+    double t0 = stat_clock();
+    char proc[32];
+    snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+    if (overwrite_file(AT_FDCWD, proc, path, 0, o, w) < 0) {
+        fprintf(diag(), "Failed to securely overwrite %s\n", path);
+        return 2;
+    }
+    stat_since(STAT_FILE, t0);
+    return 0;
+}
+
+/*
+ * --numa: on a multi-socket host, workers are pinned round-robin to the NUMA
+ * nodes, with CPU affinity and a preferred memory policy so that arenas,
+ * rings and stripe threads (which inherit both) are node-local. Each file is
+ * queued for the node its block device hangs off, which is the first
+ * numa_node found walking up the device's sysfs path (through the first
+ * slave of dm/md devices). Everything comes from sysfs and raw syscalls;
+ * there is no libnuma.
+ */
+#define NUMA_MAX 64
+#define NUMA_DEV_CACHE 16
+#define MPOL_PREFERRED 1
+
+struct numa_dev {
+    dev_t dev;
+    int node;                   /* index into numa.id, -1 = none found */
+};
+
+static struct {
+    bool on;
+    int nnodes;
+    int id[NUMA_MAX];           /* kernel node numbers */
+    cpu_set_t cpus[NUMA_MAX];   /* each node's CPUs that this process may use */
+    pthread_mutex_t lock;
+    struct numa_dev cache[NUMA_DEV_CACHE];
+    unsigned ncache;
+    unsigned rr;                /* devices without a node take turns */
+} numa = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+#ifndef SHREDDER_LIBRARY
+/* a sysfs list such as "0-3,8,10-11"; -1 if unreadable */
+static int read_list(const char *path, cpu_set_t *set) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+    char buf[4096];
+    bool ok = fgets(buf, sizeof(buf), fp) != NULL;
+    fclose(fp);
+    if (!ok) return -1;
+    CPU_ZERO(set);
+    for (char *s = buf; *s && *s != '\n';) {
+        char *end;
+        long lo = strtol(s, &end, 10), hi = lo;
+        if (end == s) return -1;
+        if (*end == '-') {
+            s = end + 1;
+            hi = strtol(s, &end, 10);
+            if (end == s) return -1;
+        }
+        for (long i = lo; i <= hi && i < CPU_SETSIZE; ++i) CPU_SET((int)i, set);
+        s = *end == ',' ? end + 1 : end;
+    }
+    return 0;
+}
+
+static void numa_init(bool verbose) {
+    cpu_set_t online, mine;
+    if (read_list("/sys/devices/system/node/online", &online) != 0 || sched_getaffinity(0, sizeof(mine), &mine) != 0)
+        CPU_ZERO(&online);
+    for (int n = 0; n < CPU_SETSIZE && numa.nnodes < NUMA_MAX; ++n) {
+        if (!CPU_ISSET(n, &online)) continue;
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n);
+        cpu_set_t *c = &numa.cpus[numa.nnodes];
+        if (read_list(path, c) != 0) continue;
+        CPU_AND(c, c, &mine);
+        if (CPU_COUNT(c) == 0) continue; /* memory-only node, or outside our cpuset */
+        numa.id[numa.nnodes++] = n;
+    }
+    numa.on = numa.nnodes > 1;
+    if (verbose) {
+        if (numa.on) fprintf(stderr, "NUMA: %d nodes, workers pinned round-robin\n", numa.nnodes);
+        else fprintf(stderr, "NUMA: single node, nothing to place\n");
+    }
+}
+#endif /* SHREDDER_LIBRARY */
+
+/* kernel node nearest block device dev, or -1 */
+static int sysfs_dev_numa(dev_t dev, int depth) {
+    char path[PATH_MAX], real[PATH_MAX];
+    snprintf(path, sizeof(path), "/sys/dev/block/%u:%u", major(dev), minor(dev));
+    if (!realpath(path, real)) return -1;
+    /* the disk, then its controller, then the PCI function behind it */
+    size_t stop = strlen("/sys/devices");
+    while (strlen(real) > stop) {
+        char attr[PATH_MAX + 16];
+        snprintf(attr, sizeof(attr), "%s/numa_node", real);
+        FILE *fp = fopen(attr, "r");
+        if (fp) {
+            int node = -1;
+            bool ok = fscanf(fp, "%d", &node) == 1;
+            fclose(fp);
+            if (ok && node >= 0) return node;
+        }
+        *strrchr(real, '/') = '\0';
+    }
+    /* dm, md: ask the first device underneath */
+    snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/slaves", major(dev), minor(dev));
+    DIR *dir = depth < 4 ? opendir(path) : NULL;
+    int node = -1;
+    for (struct dirent *e; dir && (e = readdir(dir));) {
+        if (e->d_name[0] == '.') continue;
+        char attr[PATH_MAX];
+        snprintf(attr, sizeof(attr), "/sys/class/block/%s/dev", e->d_name);
+        FILE *fp = fopen(attr, "r");
+        unsigned maj, min;
+        if (fp && fscanf(fp, "%u:%u", &maj, &min) == 2) node = sysfs_dev_numa(makedev(maj, min), depth + 1);
+        if (fp) fclose(fp);
+        break;
+    }
+    if (dir) closedir(dir);
+    return node;
+}
+
+/* node index (0..nnodes-1) for files on dev */
+static int numa_dev_node(dev_t dev) {
+    int idx = -2;
+    pthread_mutex_lock(&numa.lock);
+    for (unsigned i = 0; i < numa.ncache && idx == -2; ++i)
+        if (numa.cache[i].dev == dev) idx = numa.cache[i].node;
+    pthread_mutex_unlock(&numa.lock);
+    if (idx == -2) {
+        int node = major(dev) ? sysfs_dev_numa(dev, 0) : -1; /* major 0: tmpfs, NFS, ... */
+        idx = -1;
+        for (int i = 0; i < numa.nnodes; ++i)
+            if (numa.id[i] == node) idx = i;
+        pthread_mutex_lock(&numa.lock);
+        if (numa.ncache < NUMA_DEV_CACHE) numa.cache[numa.ncache++] = (struct numa_dev){ dev, idx };
+        pthread_mutex_unlock(&numa.lock);
+    }
+    if (idx < 0) idx = (int)(__atomic_fetch_add(&numa.rr, 1, __ATOMIC_RELAXED) % (unsigned)numa.nnodes);
+    return idx;
+}
+
+/* pin the calling thread to node index idx and prefer its memory */
+static void numa_bind(int idx) {
+    unsigned long mask[CPU_SETSIZE / (8 * sizeof(unsigned long))] = { 0 };
+    int id = numa.id[idx];
+    mask[id / (8 * sizeof(unsigned long))] |= 1UL << (id % (8 * sizeof(unsigned long)));
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &numa.cpus[idx]);
+    syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, (unsigned long)CPU_SETSIZE);
+}
+
+/*
+ * Bounded worker pool for -j. The producer blocks in pool_submit() once
+ * POOL_QUEUE_PER_WORKER jobs per worker are waiting, so memory stays flat no
+ * matter how many paths are fed in. Workers that discover more work (the -r
+ * walker) never block on the queue: when it is full they run the job
+ * themselves. With one worker everything runs inline on the caller's thread
+ * and diagnostics stay live on stderr. Under --numa there is one queue per
+ * node, and under --schedule size each node has a second one for files of
+ * SCHED_LARGE bytes or more, taken first by dedicated workers so that one
+ * huge file neither starts last nor holds up the small ones. A worker takes
+ * from its own queue and, when that is empty, from any queue that is not:
+ * its node's other lane first, then the other nodes'. A job queued while all
+ * of its queue's workers are busy wakes an idle worker of another queue.
+ */
+#define POOL_QUEUE_PER_WORKER 4
+#define SCHED_LARGE ((off_t)256 << 20)
+
+enum job_kind {
+    JOB_PATH,                   /* command-line or --files-from path */
+    JOB_ENTRY,                  /* regular file found by the walker */
+    JOB_DIR,                    /* directory to walk */
+    JOB_FD,                     /* --daemon: descriptor passed by a client */
+};
+
+struct shred_job {
+    enum job_kind kind;
+    const char *name;           /* JOB_PATH: path; JOB_ENTRY: name inside batch; JOB_FD: name for messages */
+    bool owned;                 /* JOB_PATH: name is heap memory the job frees */
+    struct dir_batch *batch;    /* JOB_ENTRY */
+    struct dir_ref *dir;        /* JOB_DIR */
+    int fd;                     /* JOB_FD, closed once shredded */
+    int node;                   /* --numa: index of the node nearest the file */
+    bool large;                 /* --schedule size: for the large-file workers */
+    uid_t owner;                /* --daemon: the client's uid, see worker.owner */
+    shredder_done_fn done;      /* --daemon, library: told the outcome, or NULL */
+    void *done_arg;
+    uint64_t id;                /* passed on to done */
+};
+
+struct pool_queue {
+    struct shred_job *ring;     /* pending jobs */
+    size_t head, count;
+    pthread_cond_t not_empty;
+    unsigned workers;           /* workers that take from this queue first */
+    unsigned waiting;           /* of those, asleep on not_empty */
+    unsigned woken;             /* signals sent to them not yet taken up */
+};
+
+struct shred_pool {
+    const struct shred_opts *opts;
+    pthread_t *threads;
+    int nthreads;
+    int nstarted;               /* workers that have picked their queue */
+
+    pthread_mutex_t lock;
+    pthread_cond_t not_full;
+    struct pool_queue *queues;  /* per NUMA node (or one), lanes each */
+    int nqueues;
+    int lanes;                  /* 2 under --schedule size: small files, then large */
+    int large_workers;          /* the first this many workers take large files first */
+    size_t cap;                 /* per queue */
+    size_t count;               /* jobs in all queues */
+    size_t active;              /* jobs being run; they may queue more */
+    bool closed;
+
+    struct worker inline_worker; /* used when running without threads */
+    pthread_mutex_t out_lock; /* serializes per-file diagnostic blocks */
+    int exit_status;
+    size_t files;
+    size_t failed;
+};
+
+static void pool_record(struct shred_pool *p, int status) {
+    pthread_mutex_lock(&p->lock);
+    p->files++;
+    if (status != 0) {
+        p->exit_status = status;
+        p->failed++;
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* failure not tied to one file (walking or removing a directory) */
+static void pool_error(struct shred_pool *p) {
+    pthread_mutex_lock(&p->lock);
+    p->exit_status = 2;
+    pthread_mutex_unlock(&p->lock);
+}
+
+/*
+ * -r: directories are walked with openat()/getdents64() relative to their
+ * parent's fd. Entries are read in DIR_BATCH_SIZE blocks and file jobs point
+ * straight into their block, which lives until its last file is done, so the
+ * walker never builds per-file path strings (only messages do, on the stack).
+ * Files and subdirectories go to the workers as soon as they are read; each
+ * directory is removed once its last child has finished.
+ */
+#define DIR_BATCH_SIZE (64 * 1024)
+
+struct dir_ref {
+    struct dir_ref *parent;
+    struct shred_pool *pool;
+    int fd;
+    int node;                   /* --numa: queue for its entries */
+    unsigned refs;              /* walker + pending children */
+    const char *name;           /* name within parent (points into path) */
+    char path[];                /* for messages */
+};
+
+/*
+ * One getdents64() buffer of entries. Its files are renamed to random names as
+ * they finish, and unlinked together once the last of them is done, behind a
+ * single fsync() of the directory instead of one per file.
+ */
+struct dir_batch {
+    struct dir_ref *dir;
+    unsigned refs;              /* walker + pending file jobs */
+    char (*renamed)[RANDOM_NAME_LEN + 1];
+    unsigned nrenamed;          /* slots taken with __atomic_fetch_add */
+    char buf[DIR_BATCH_SIZE];
+};
+
+/* the smallest dirent64 record: header plus a one-byte name, 8-byte aligned */
+#define DIRENT_MIN_RECLEN 24
+
+static struct dir_ref *dir_new(struct shred_pool *p, struct dir_ref *parent, const char *name, int fd) {
+    size_t plen = parent ? strlen(parent->path) + 1 : 0;
+    struct dir_ref *d = alloc_buf(sizeof(*d) + plen + strlen(name) + 1);
+    if (!d) return NULL;
+    d->parent = parent;
+    d->pool = p;
+    d->fd = fd;
+    d->refs = 1;
+    /* a subdirectory stays with its parent's node; mounts inside the tree are rare */
+    struct stat st;
+    d->node = parent ? parent->node : numa.on && fstat(fd, &st) == 0 ? numa_dev_node(st.st_dev) : 0;
+    if (parent) {
+        sprintf(d->path, "%s/%s", parent->path, name);
+        d->name = d->path + plen;
+        __atomic_add_fetch(&parent->refs, 1, __ATOMIC_RELAXED);
+    } else {
+        strcpy(d->path, name);
+        d->name = d->path;
+    }
+    return d;
+}
+
+static void dir_unref(struct dir_ref *d) {
+    if (__atomic_sub_fetch(&d->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+    bool verbose = d->pool->opts->verbose;
+    int pfd = d->parent ? d->parent->fd : AT_FDCWD;
+    close(d->fd);
+
+    /* hide the directory name as well, then remove it */
+    char newname[RANDOM_NAME_LEN + 1];
+    const char *victim = d->name;
+    if (rename_random(pfd, d->name, newname) == 0) victim = newname;
+    if (unlinkat(pfd, victim, AT_REMOVEDIR) != 0) {
+        int err = errno;
+        /* something was left behind (skipped or failed): keep its real name */
+        if (victim == newname) renameat(pfd, newname, pfd, d->name);
+        fprintf(diag(), "rmdir %s: %s\n", d->path, strerror(err));
+        pool_error(d->pool);
+    } else if (verbose) {
+        fprintf(diag(), "Removed directory %s\n", d->path);
+    }
+    if (d->parent) dir_unref(d->parent);
+    free(d);
+}
+
+static void batch_unref(struct dir_batch *b) {
+    if (__atomic_sub_fetch(&b->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+    struct dir_ref *d = b->dir;
+    if (b->nrenamed) {
+        /* persist the renames before any unlink, as rename_and_unlink() does per file */
+        double t0 = stat_clock();
+        if (fsync(d->fd) != 0 && d->pool->opts->verbose) diag_errno("fsync(dir)");
+        stat_since(STAT_DIR_FSYNC, t0);
+        for (unsigned i = 0; i < b->nrenamed; ++i) {
+            t0 = stat_clock();
+            if (b->renamed[i][0] && unlinkat(d->fd, b->renamed[i], 0) != 0) {
+                fprintf(diag(), "unlink %s/%s: %s\n", d->path, b->renamed[i], strerror(errno));
+                pool_error(d->pool);
+            } else if (b->renamed[i][0]) {
+                stat_since(STAT_UNLINK, t0);
+            }
+        }
+        if (d->pool->opts->verbose) fprintf(diag(), "Unlinked %u files in %s\n", b->nrenamed, d->path);
+    }
+    dir_unref(d);
+    free(b->renamed);
+    free(b);
+}
+
+/* overwrite and rename one entry found by the walker; batch_unref() unlinks it */
+static int shred_entry(struct dir_batch *b, const char *name, const struct shred_opts *o, struct worker *w) {
+    bool verbose = o->verbose;
+    struct dir_ref *d = b->dir;
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", d->path, name);
+    if (shred_interrupted) return 2; /* --journal: leave the rest for the next run */
+    if (verbose) fprintf(diag(), "Processing %s\n", path);
+    double t_file = stat_clock();
+
+    if (overwrite_file(d->fd, name, path, AT_SYMLINK_NOFOLLOW, o, w) < 0) {
+        fprintf(diag(), "Failed to securely overwrite %s\n", path);
+        return 2;
+    }
+
+    unsigned slot = __atomic_fetch_add(&b->nrenamed, 1, __ATOMIC_RELAXED);
+    char *newname = b->renamed[slot];
+    double t0 = stat_clock();
+    if (rename_random(d->fd, name, newname) == 0) {
+        stat_since(STAT_RENAME, t0);
+        stat_since(STAT_FILE, t_file);
+        if (verbose) fprintf(diag(), "Renamed %s -> %s/%s\n", path, d->path, newname);
+        return 0;
+    }
+    if (verbose) diag_errno("rename");
+    newname[0] = '\0'; /* nothing for the batch; unlink the original name now */
+    if (unlinkat(d->fd, name, 0) != 0) {
+        if (verbose) diag_errno("unlink");
+        return 2;
+    }
+    if (verbose) fprintf(diag(), "Unlinked %s\n", path);
+    return 0;
+}
+
+/*
+ * Inode numbers already dispatched from the directory being walked. Workers
+ * rename files (and removed subdirectories) inside it while the walker is still
+ * reading, so the same inode can show up again under its random name.
+ */
+struct ino_set {
+    uint64_t *slot;             /* open addressing, 0 = empty */
+    size_t cap, count;
+};
+
+static size_t ino_hash(uint64_t ino, size_t cap) {
+    return (size_t)((ino * 0x9E3779B97F4A7C15ull) >> 20) & (cap - 1);
+}
+
+/* false if ino was already in the set */
+static bool ino_set_add(struct ino_set *s, uint64_t ino) {
+    if (ino == 0) return true;
+    if ((s->count + 1) * 2 > s->cap) {
+        size_t ncap = s->cap ? s->cap * 2 : 1024;
+        uint64_t *nslot = calloc(ncap, sizeof(*nslot));
+        if (!nslot) return true; /* no dedup is better than no shredding */
+        for (size_t i = 0; i < s->cap; ++i) {
+            if (!s->slot[i]) continue;
+            size_t h = ino_hash(s->slot[i], ncap);
+            while (nslot[h]) h = (h + 1) & (ncap - 1);
+            nslot[h] = s->slot[i];
+        }
+        free(s->slot);
+        s->slot = nslot;
+        s->cap = ncap;
+    }
+    size_t h = ino_hash(ino, s->cap);
+    while (s->slot[h]) {
+        if (s->slot[h] == ino) return false;
+        h = (h + 1) & (s->cap - 1);
+    }
+    s->slot[h] = ino;
+    s->count++;
+    return true;
+}
+
+static void pool_spawn(struct shred_pool *p, struct worker *w, const struct shred_job *job);
+
+static void walk_dir(struct shred_pool *p, struct worker *w, struct dir_ref *d) {
+    struct ino_set seen = { 0 };
+    for (;;) {
+        struct dir_batch *b = alloc_buf(sizeof(*b));
+        if (!b) {
+            pool_error(p);
+            break;
+        }
+        b->dir = d;
+        b->refs = 1;
+        b->renamed = NULL;
+        b->nrenamed = 0;
+        __atomic_add_fetch(&d->refs, 1, __ATOMIC_RELAXED);
+
+        ssize_t n = getdents64(d->fd, b->buf, sizeof(b->buf));
+        if (n <= 0) {
+            if (n < 0) {
+                fprintf(diag(), "getdents64 %s: %s\n", d->path, strerror(errno));
+                pool_error(p);
+            }
+            batch_unref(b);
+            break;
+        }
+        b->renamed = alloc_buf(((size_t)n / DIRENT_MIN_RECLEN + 1) * sizeof(*b->renamed));
+        if (!b->renamed) {
+            pool_error(p);
+            batch_unref(b);
+            break;
+        }
+        for (ssize_t off = 0; off < n;) {
+            struct dirent64 *e = (struct dirent64 *)(b->buf + off);
+            off += e->d_reclen;
+            const char *name = e->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+            if (!ino_set_add(&seen, e->d_ino)) continue;
+
+            unsigned char type = e->d_type;
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+                if (fstatat(d->fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) type = IFTODT(st.st_mode);
+            }
+            if (type == DT_DIR) {
+                int fd = openat(d->fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                if (fd < 0) {
+                    fprintf(diag(), "open %s/%s: %s\n", d->path, name, strerror(errno));
+                    pool_error(p);
+                    continue;
+                }
+                struct shred_job job = { .kind = JOB_DIR, .dir = dir_new(p, d, name, fd), .node = d->node };
+                if (!job.dir) {
+                    close(fd);
+                    pool_error(p);
+                    continue;
+                }
+                pool_spawn(p, w, &job);
+            } else if (type == DT_REG) {
+                __atomic_add_fetch(&b->refs, 1, __ATOMIC_RELAXED);
+                struct shred_job job = { .kind = JOB_ENTRY, .name = name, .batch = b, .node = d->node };
+                pool_spawn(p, w, &job);
+            } else {
+                fprintf(diag(), "skipping non-regular file: %s/%s\n", d->path, name);
+                pool_error(p);
+            }
+        }
+        batch_unref(b);
+    }
+    free(seen.slot);
+    dir_unref(d); /* the walker's own reference */
+}
+
+/* -r on a command-line directory */
+static void walk_root(struct shred_pool *p, struct worker *w, const char *path) {
+    struct stat st, root;
+    if (stat("/", &root) == 0 && stat(path, &st) == 0 && st.st_dev == root.st_dev && st.st_ino == root.st_ino) {
+        fprintf(diag(), "refusing to shred the root directory\n");
+        pool_error(p);
+        return;
+    }
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(diag(), "open %s: %s\n", path, strerror(errno));
+        pool_error(p);
+        return;
+    }
+    char *trimmed = strdup(path);
+    if (!trimmed) {
+        close(fd);
+        pool_error(p);
+        return;
+    }
+    for (size_t len = strlen(trimmed); len > 1 && trimmed[len - 1] == '/'; --len) trimmed[len - 1] = '\0';
+    struct dir_ref *d = dir_new(p, NULL, trimmed, fd);
+    free(trimmed);
+    if (!d) {
+        close(fd);
+        pool_error(p);
+        return;
+    }
+    walk_dir(p, w, d);
+}
+
+static int shred_job_file(struct shred_pool *p, struct worker *w, const struct shred_job *job) {
+    if (job->kind == JOB_ENTRY) return shred_entry(job->batch, job->name, p->opts, w);
+    if (job->kind == JOB_FD) return shred_fd(job->fd, job->name, p->opts, w);
+    return shred_path(job->name, job->done == NULL, p->opts, w);
+}
+
+/* worker_flush(), with a failed unlink counted against the run */
+static void pool_flush(struct shred_pool *p, struct worker *w) {
+    worker_flush(w, p->opts->verbose);
+    if (w->flush_failed) pool_error(p);
+    w->flush_failed = false;
+}
+
+static int shred_buffered(struct shred_pool *p, struct worker *w, const struct shred_job *job) {
+    if (p->nthreads == 0) {
+        int status = shred_job_file(p, w, job);
+        pool_record(p, status);
+        return status;
+    }
+    char *log = NULL;
+    size_t loglen = 0;
+    diag_stream = open_memstream(&log, &loglen);
+    int status = shred_job_file(p, w, job);
+    if (diag_stream) {
+        fclose(diag_stream);
+        diag_stream = NULL;
+        pthread_mutex_lock(&p->out_lock);
+        fwrite(log, 1, loglen, p->opts->log ? p->opts->log : stderr);
+        pthread_mutex_unlock(&p->out_lock);
+        free(log);
+    }
+    pool_record(p, status);
+    return status;
+}
+
+static void run_job(struct shred_pool *p, struct worker *w, const struct shred_job *job) {
+    struct stat st;
+    int status = 0;
+    w->owner = job->owner;
+    switch (job->kind) {
+        case JOB_PATH:
+            if (p->opts->recursive && stat(job->name, &st) == 0 && S_ISDIR(st.st_mode))
+                walk_root(p, w, job->name);
+            else
+                status = shred_buffered(p, w, job);
+            if (w->flush_failed) pool_flush(p, w);
+            if (job->owned) free((char *)job->name);
+            break;
+        case JOB_ENTRY:
+            shred_buffered(p, w, job);
+            batch_unref(job->batch);
+            break;
+        case JOB_DIR:
+            walk_dir(p, w, job->dir);
+            break;
+        case JOB_FD:
+            status = shred_buffered(p, w, job);
+            close(job->fd);
+            free((char *)job->name);
+            break;
+    }
+    w->owner = 0;
+    if (job->done) job->done(job->done_arg, job->id, status == 0 ? 0 : -1);
+}
+
+static bool queue_has_jobs(const struct pool_queue *q) { return q->count > 0; }
+static bool queue_has_idle(const struct pool_queue *q) { return q->waiting > q->woken; }
+
+/* first queue other than q for which want() holds, or -1: q's node's other lane, then the other nodes' */
+static int pool_find(const struct shred_pool *p, int q, bool (*want)(const struct pool_queue *)) {
+    int lanes = p->lanes, nodes = p->nqueues / lanes, node = q / lanes, lane = q % lanes;
+    for (int m = 0; m < nodes; ++m)
+        for (int l = 0; l < lanes; ++l) {
+            int i = (node + m) % nodes * lanes + (lane + l) % lanes;
+            if (i != q && want(&p->queues[i])) return i;
+        }
+    return -1;
+}
+
+/* queue a worker of queue q should take from next, or -1 */
+static int pool_pick(const struct shred_pool *p, int q) {
+    return p->queues[q].count ? q : pool_find(p, q, queue_has_jobs);
+}
+
+static struct pool_queue *pool_queue_of(struct shred_pool *p, const struct shred_job *job) {
+    return &p->queues[job->node * p->lanes + (job->large && p->lanes > 1 ? 1 : 0)];
+}
+
+static void pool_wake_all(struct shred_pool *p) {
+    for (int i = 0; i < p->nqueues; ++i) pthread_cond_broadcast(&p->queues[i].not_empty);
+}
+
+static void *pool_worker(void *arg) {
+    struct shred_pool *p = arg;
+    struct worker w = { 0 };
+    pthread_mutex_lock(&p->lock);
+    int k = p->nstarted++, node = numa.on ? k % numa.nnodes : 0;
+    int q = node * p->lanes + (k < p->large_workers ? 1 : 0);
+    p->queues[q].workers++;
+    pthread_mutex_unlock(&p->lock);
+    if (numa.on) numa_bind(node);
+    for (;;) {
+        pthread_mutex_lock(&p->lock);
+        int from;
+        /* nothing to take: unlink what the last paths left renamed before sleeping */
+        if (w.nrenamed && pool_pick(p, q) < 0) {
+            pthread_mutex_unlock(&p->lock);
+            pool_flush(p, &w);
+            continue;
+        }
+        while ((from = pool_pick(p, q)) < 0 && !(p->closed && p->active == 0 && p->count == 0)) {
+            struct pool_queue *own = &p->queues[q];
+            own->waiting++;
+            pthread_cond_wait(&own->not_empty, &p->lock);
+            own->waiting--;
+            if (own->woken) own->woken--;
+        }
+        if (from < 0) {
+            pthread_mutex_unlock(&p->lock);
+            worker_release(&w);
+            return NULL;
+        }
+        struct pool_queue *pq = &p->queues[from];
+        struct shred_job job = pq->ring[pq->head];
+        pq->head = (pq->head + 1) % p->cap;
+        pq->count--;
+        p->count--;
+        p->active++;
+        pthread_cond_signal(&p->not_full);
+        pthread_mutex_unlock(&p->lock);
+
+        run_job(p, &w, &job);
+
+        pthread_mutex_lock(&p->lock);
+        p->active--;
+        if (p->closed && p->active == 0 && p->count == 0) pool_wake_all(p);
+        pthread_mutex_unlock(&p->lock);
+    }
+}
+
+/*
+ * large_workers: --schedule size, workers that take large files first (0 = one
+ * lane); threaded: start a worker even for -j 1 (--daemon, whose own thread
+ * serves the socket)
+ */
+/*
+ * -1 (ENOMEM, or EAGAIN when no thread would start) if the pool has no
+ * workers; pool_finish() cleans up either way. A partial pool still drains
+ * the queue; none at all means pool_submit() runs jobs inline.
+ */
+static int pool_start(struct shred_pool *p, const struct shred_opts *o, int large_workers, bool threaded) {
+    memset(p, 0, sizeof(*p));
+    p->opts = o;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_mutex_init(&p->out_lock, NULL);
+    pthread_cond_init(&p->not_full, NULL);
+    if (o->jobs <= 1 && !threaded) return 0;
+
+    p->cap = (size_t)o->jobs * POOL_QUEUE_PER_WORKER;
+    p->lanes = large_workers > 0 ? 2 : 1;
+    p->large_workers = large_workers;
+    int nqueues = (numa.on ? numa.nnodes : 1) * p->lanes;
+    p->queues = alloc_buf((size_t)nqueues * sizeof(*p->queues));
+    if (!p->queues) return -1;
+    for (; p->nqueues < nqueues; p->nqueues++) {
+        struct pool_queue *q = &p->queues[p->nqueues];
+        *q = (struct pool_queue){ .ring = alloc_buf(p->cap * sizeof(struct shred_job)) };
+        if (!q->ring) return -1;
+        pthread_cond_init(&q->not_empty, NULL);
+    }
+    p->threads = alloc_buf((size_t)o->jobs * sizeof(*p->threads));
+    if (!p->threads) return -1;
+    for (int i = 0; i < o->jobs; ++i) {
+        if (pthread_create(&p->threads[i], NULL, pool_worker, p) != 0) break;
+        p->nthreads++;
+    }
+    if (p->nthreads == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return 0;
+}
+
+static void pool_enqueue(struct shred_pool *p, const struct shred_job *job) {
+    struct pool_queue *q = pool_queue_of(p, job);
+    q->ring[(q->head + q->count) % p->cap] = *job;
+    q->count++;
+    p->count++;
+    /* one of this queue's own idle workers, else whichever other queue's is nearest */
+    int i = (int)(q - p->queues);
+    if (!queue_has_idle(q)) i = pool_find(p, i, queue_has_idle);
+    if (i >= 0) {
+        p->queues[i].woken++;
+        pthread_cond_signal(&p->queues[i].not_empty);
+    }
+}
+
+/* --numa node and --schedule lane of a job for the file st describes */
+static void pool_place(const struct shred_pool *p, struct shred_job *job, const struct stat *st) {
+    if (p->nqueues <= 1) return;
+    if (numa.on) job->node = numa_dev_node(S_ISBLK(st->st_mode) ? st->st_rdev : st->st_dev);
+    job->large = S_ISBLK(st->st_mode) || st->st_size >= SCHED_LARGE;
+}
+
+/* from the submitting thread: waits for room in the queue; st, if known, places the job */
+static void pool_submit_job(struct shred_pool *p, struct shred_job *job, const struct stat *st) {
+    if (p->nthreads == 0) {
+        run_job(p, &p->inline_worker, job);
+        return;
+    }
+    if (st) pool_place(p, job, st);
+    pthread_mutex_lock(&p->lock);
+    while (pool_queue_of(p, job)->count == p->cap) pthread_cond_wait(&p->not_full, &p->lock);
+    pool_enqueue(p, job);
+    pthread_mutex_unlock(&p->lock);
+}
+
+#ifndef SHREDDER_LIBRARY
+/* queue one path; with owned set, path was malloc'd and is freed once shredded */
+static void pool_submit(struct shred_pool *p, const char *path, bool owned) {
+    struct shred_job job = { .kind = JOB_PATH, .name = path, .owned = owned };
+    struct stat st;
+    pool_submit_job(p, &job, p->nqueues > 1 && stat(path, &st) == 0 ? &st : NULL);
+}
+#endif /* SHREDDER_LIBRARY */
+
+/* queue a job if its queue has room, without waiting; the pool must have threads */
+static bool pool_offer(struct shred_pool *p, const struct shred_job *job) {
+    pthread_mutex_lock(&p->lock);
+    bool queued = pool_queue_of(p, job)->count < p->cap;
+    if (queued) pool_enqueue(p, job);
+    pthread_mutex_unlock(&p->lock);
+    return queued;
+}
+
+/* from inside a job: never waits, runs the job here if the queue is full */
+static void pool_spawn(struct shred_pool *p, struct worker *w, const struct shred_job *job) {
+    if (p->nthreads > 0 && pool_offer(p, job)) return;
+    run_job(p, w, job);
+}
+
+#ifndef SHREDDER_LIBRARY
+/*
+ * --files-from: read paths one at a time (newline- or, with -0, NUL-terminated)
+ * and feed each into the pool as it is read. pool_submit() blocks while the
+ * queue is full, so a list of millions of paths is never held in memory.
+ */
+static int submit_stream(struct shred_pool *p, const char *file, int delim, bool verbose) {
+    bool is_stdin = strcmp(file, "-") == 0;
+    FILE *in = is_stdin ? stdin : fopen(file, "r");
+    if (!in) {
+        perror(file);
+        return -1;
+    }
+    char *line = NULL;
+    size_t cap = 0, count = 0;
+    ssize_t len;
+    int rc = 0;
+    while (!shred_interrupted && (len = getdelim(&line, &cap, delim, in)) > 0) {
+        if (line[len - 1] == delim) line[--len] = '\0';
+        if (len == 0) continue;
+        char *path = strdup(line);
+        if (!path) {
+            rc = -1;
+            break;
+        }
+        pool_submit(p, path, true);
+        count++;
+    }
+    if (ferror(in)) rc = -1;
+    if (rc != 0) perror(file);
+    free(line);
+    if (!is_stdin) fclose(in);
+    if (verbose) fprintf(stderr, "Read %zu paths from %s\n", count, is_stdin ? "stdin" : file);
+    return rc;
+}
+#endif /* SHREDDER_LIBRARY */
+
+/* close the queue, wait for the workers and return the combined exit status */
+static int pool_finish(struct shred_pool *p) {
+    pthread_mutex_lock(&p->lock);
+    p->closed = true;
+    if (p->queues) pool_wake_all(p);
+    pthread_mutex_unlock(&p->lock);
+    for (int i = 0; i < p->nthreads; ++i) pthread_join(p->threads[i], NULL);
+    free(p->threads);
+    for (int i = 0; i < p->nqueues; ++i) {
+        free(p->queues[i].ring);
+        pthread_cond_destroy(&p->queues[i].not_empty);
+    }
+    free(p->queues);
+    pool_flush(p, &p->inline_worker);
+    worker_release(&p->inline_worker);
+    pthread_mutex_destroy(&p->lock);
+    pthread_mutex_destroy(&p->out_lock);
+    pthread_cond_destroy(&p->not_full);
+    return p->exit_status;
+}
+
+/*
+ * Library API (shredder.h), built with -DSHREDDER_LIBRARY: the command line's
+ * pipeline for callers that shred in-process. The synchronous calls run on the
+ * caller's thread with a worker kept per thread until it exits; a struct
+ * shredder owns a pool like -j's and tells each request's callback when it
+ * is done. Everything from here to the end of the file is the command line.
+ */
+struct shredder {
+    struct shred_opts o;
+    struct pass_spec scheme[SCHEME_MAX];
+    struct shred_pool pool;
+};
+
+static pthread_key_t lib_worker_key;
+static pthread_once_t lib_worker_once = PTHREAD_ONCE_INIT;
+static __thread struct worker *lib_worker;
+
+static void lib_worker_release(void *arg) {
+    worker_release(arg);
+    free(arg);
+}
+
+static void lib_worker_key_create(void) {
+    pthread_key_create(&lib_worker_key, lib_worker_release);
+}
+
+/* the calling thread's worker: arenas, ring and directory cache reused across calls */
+static struct worker *lib_thread_worker(void) {
+    if (lib_worker) return lib_worker;
+    pthread_once(&lib_worker_once, lib_worker_key_create);
+    struct worker *w = calloc(1, sizeof(*w));
+    if (!w) return NULL;
+    pthread_setspecific(lib_worker_key, w);
+    return lib_worker = w;
+}
+
+/* shredder_opts as the command line's options; -1 (EINVAL) for values it would reject */
+static int lib_opts(struct shred_opts *o, struct pass_spec *scheme, const struct shredder_opts *in) {
+    if ((in->block_size && (in->block_size < 4096 || in->block_size > ((size_t)1 << 30))) || in->sync_every < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    *o = (struct shred_opts){
+        .passes = in->passes < 1 ? 1 : in->passes,
+        .final_zero = in->zero,
+        .verbose = in->verbose,
+        .rng = in->rng == SHREDDER_RNG_CHACHA ? RNG_CHACHA : RNG_KERNEL,
+        .jobs = 1,
+        .engine = in->engine == SHREDDER_ENGINE_URING  ? ENGINE_URING
+                  : in->engine == SHREDDER_ENGINE_MMAP ? ENGINE_MMAP
+                                                       : ENGINE_WRITE,
+        .queue_depth = in->queue_depth < 1 ? 1 : in->queue_depth > 1024 ? 1024 : in->queue_depth,
+        .direct = in->direct,
+        .chunk = in->block_size ? in->block_size : CHUNK,
+        .sync_every = in->sync_every,
+        .sparse = in->sparse,
+        .zero_offload = true,
+        .cow = COW_WARN,
+        .discard = in->discard ? DISCARD_ON : DISCARD_NONE,
+        .progress = in->progress,
+        .progress_arg = in->progress_arg,
+        .log = in->log,
+    };
+    if (in->scheme) {
+        o->scheme_len = parse_scheme(in->scheme, scheme, &o->pattern_max);
+        if (o->scheme_len <= 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        o->scheme = scheme;
+    }
+    return 0;
+}
+
+void shredder_opts_init(struct shredder_opts *opts) {
+    *opts = (struct shredder_opts){
+        .passes = 3,
+        .sync_every = 1,
+        .rng = SHREDDER_RNG_KERNEL,
+        .engine = SHREDDER_ENGINE_WRITE,
+        .queue_depth = 16,
+    };
+}
+
+/* one file on the calling thread: fd >= 0 for shred_fd(), else path */
+static int lib_shred(const struct shredder_opts *opts, int fd, const char *path) {
+    struct shred_opts o;
+    struct pass_spec scheme[SCHEME_MAX];
+    if (lib_opts(&o, scheme, opts) != 0) return -1;
+    struct worker *w = lib_thread_worker();
+    if (!w) {
+        errno = ENOMEM;
+        return -1;
+    }
+    FILE *saved = diag_stream;
+    if (o.log) diag_stream = o.log;
+    int status = fd >= 0 ? shred_fd(fd, path, &o, w) : shred_path(path, false, &o, w);
+    diag_stream = saved;
+    return status == 0 ? 0 : -1;
+}
+
+int shredder_path(const char *path, const struct shredder_opts *opts) {
+    return lib_shred(opts, -1, path);
+}
+
+int shredder_fd(int fd, const struct shredder_opts *opts) {
+    char name[32];
+    snprintf(name, sizeof(name), "fd %d", fd);
+    return lib_shred(opts, fd, name);
+}
+
+struct shredder *shredder_open(const struct shredder_opts *opts, int threads) {
+    struct shredder *s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
+    if (lib_opts(&s->o, s->scheme, opts) != 0) {
+        free(s);
+        return NULL;
+    }
+    s->o.jobs = threads > 0 ? threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (s->o.jobs < 1) s->o.jobs = 1;
+    if (pool_start(&s->pool, &s->o, 0, true) != 0) {
+        int err = errno;
+        pool_finish(&s->pool);
+        free(s);
+        errno = err;
+        return NULL;
+    }
+    return s;
+}
+
+int shredder_submit_path(struct shredder *s, const char *path, uint64_t id, shredder_done_fn done, void *arg) {
+    char *name = strdup(path);
+    if (!name) return -1;
+    struct shred_job job = {
+        .kind = JOB_PATH, .name = name, .owned = true, .fd = -1, .done = done, .done_arg = arg, .id = id,
+    };
+    pool_submit_job(&s->pool, &job, NULL);
+    return 0;
+}
+
+int shredder_submit_fd(struct shredder *s, int fd, uint64_t id, shredder_done_fn done, void *arg) {
+    char name[32];
+    snprintf(name, sizeof(name), "fd %d", fd);
+    struct shred_job job = {
+        .kind = JOB_FD, .name = strdup(name), .fd = fcntl(fd, F_DUPFD_CLOEXEC, 0), .done = done, .done_arg = arg,
+        .id = id,
+    };
+    if (!job.name || job.fd < 0) {
+        int err = job.name ? errno : ENOMEM;
+        if (job.fd >= 0) close(job.fd);
+        free((char *)job.name);
+        errno = err;
+        return -1;
+    }
+    pool_submit_job(&s->pool, &job, NULL);
+    return 0;
+}
+
+int shredder_close(struct shredder *s) {
+    int status = pool_finish(&s->pool);
+    free(s);
+    return status == 0 ? 0 : -1;
+}
+
+#ifndef SHREDDER_LIBRARY
+
+/* bytes a path would be overwritten with: a file's size, a device's capacity, else 0 */
+static off_t path_bytes(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) return 0;
+    if (S_ISREG(st.st_mode)) return st.st_size;
+    uint64_t bytes = 0;
+    if (S_ISBLK(st.st_mode)) {
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0 || ioctl(fd, BLKGETSIZE64, &bytes) != 0) bytes = 0;
+        if (fd >= 0) close(fd);
+    }
+    return (off_t)bytes;
+}
+
+struct sized_path {
+    char *path;
+    off_t bytes;
+};
+
+static int cmp_larger(const void *a, const void *b) {
+    off_t x = ((const struct sized_path *)a)->bytes, y = ((const struct sized_path *)b)->bytes;
+    return (x < y) - (x > y);
+}
+
+/*
+ * --schedule size: sort the command-line paths largest first, the longest
+ * job first heuristic for the makespan, and return how many workers to keep
+ * for the large files: one per large file, or half the pool for a stream
+ * whose sizes are not known yet, always leaving one for the small files.
+ */
+static int schedule_paths(char **paths, size_t n, int jobs, const char *files_from, bool verbose) {
+    struct sized_path *v = alloc_buf((n ? n : 1) * sizeof(*v));
+    if (!v) return 0; /* argument order, one pool */
+    size_t nlarge = 0;
+    for (size_t i = 0; i < n; ++i) {
+        v[i] = (struct sized_path){ paths[i], path_bytes(paths[i]) };
+        if (v[i].bytes >= SCHED_LARGE) nlarge++;
+    }
+    qsort(v, n, sizeof(*v), cmp_larger);
+    for (size_t i = 0; i < n; ++i) paths[i] = v[i].path;
+    free(v);
+    size_t want = nlarge + (files_from ? (size_t)jobs / 2 : 0);
+    int large_workers = want < (size_t)jobs - 1 ? (int)want : jobs - 1;
+    if (verbose)
+        fprintf(stderr, "Schedule: largest first, %zu of %zu paths %" PRId64 " MiB or more, %d worker%s for those\n",
+                nlarge, n, (int64_t)(SCHED_LARGE >> 20), large_workers, large_workers == 1 ? "" : "s");
+    return large_workers;
+}
+
+/*
+ * --daemon SOCKET: keep the worker pool running, and with it every worker's
+ * buffers, rings, directory cache and RNG state, and take shred requests from
+ * clients on a Unix stream socket ("@name" for the abstract namespace), one
+ * per line:
+ *   SHRED <id> <path>   overwrite, rename and unlink path, as on the command line
+ *   FD <id> [<name>]    overwrite the file behind the next descriptor passed on
+ *                       the connection (SCM_RIGHTS, sent with this line); it is
+ *                       neither renamed nor unlinked
+ * <id> is any 64-bit number the client picks. Every request is answered with
+ * "DONE <id> <status>" (0, or 2 if it failed) on its connection as soon as it
+ * finishes, in completion order, and a line that is not a request with
+ * "ERR <id|-> <reason>". A client can send a whole batch before reading.
+ *
+ * One thread runs the socket with ppoll() and never blocks: a request waits in
+ * its client's buffer while the pool's queue is full (and the client's reads
+ * pause), and workers send their replies with MSG_DONTWAIT, leaving whatever
+ * the socket does not take for the loop to flush. An eventfd wakes the loop
+ * for both. SIGINT/SIGTERM stop new requests; those already read are finished
+ * and answered before the daemon exits.
+ *
+ * The daemon may run with more rights than its clients, so it checks them
+ * itself rather than trusting the socket's reach (an "@name" socket has no
+ * permissions at all): a client's SO_PEERCRED uid must be the daemon's own
+ * unless --daemon-any-user is given, and a client other than root may only
+ * have files it owns shredded, and only through descriptors it opened for
+ * writing. A socket file is created mode 0600.
+ */
+#define DAEMON_LINE_MAX (PATH_MAX + 64)
+#define DAEMON_FDS 64               /* passed descriptors ahead of their FD lines */
+
+struct daemon_client {
+    int fd;
+    uid_t uid;                      /* SO_PEERCRED of the connection */
+    pthread_mutex_t lock;           /* out, dead and pending; workers reply under it */
+    char *out;                      /* replies the socket has not taken yet */
+    size_t outlen, outcap;
+    bool dead;                      /* the connection failed: replies are dropped */
+    size_t pending;                 /* requests queued or running */
+
+    bool eof;                       /* no more requests will be read */
+    char in[DAEMON_LINE_MAX];
+    size_t inlen;
+    int fds[DAEMON_FDS];            /* ring of descriptors received for FD lines */
+    size_t fdhead, nfds;
+    struct shred_job held;          /* request waiting for room in the pool */
+    bool holding;
+};
+
+static int daemon_wake = -1;        /* eventfd the workers poke after replying */
+static volatile sig_atomic_t daemon_stopping;
+
+static void on_daemon_signal(int sig) {
+    (void)sig;
+    daemon_stopping = 1;
+}
+
+/* with c->lock held: send a reply line, or keep what the socket does not take */
+static void daemon_reply(struct daemon_client *c, const char *line, size_t len) {
+    if (c->dead) return;
+    if (c->outlen == 0) {
+        ssize_t n = send(c->fd, line, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            c->dead = true;
+            return;
+        }
+        if (n > 0) {
+            line += n;
+            len -= (size_t)n;
+        }
+    }
+    if (len == 0) return;
+    if (c->outlen + len > c->outcap) {
+        size_t cap = c->outcap ? c->outcap : 4096;
+        while (cap < c->outlen + len) cap *= 2;
+        char *grown = realloc(c->out, cap);
+        if (!grown) {
+            c->dead = true; /* its replies would be lost: drop it */
+            return;
+        }
+        c->out = grown;
+        c->outcap = cap;
+    }
+    memcpy(c->out + c->outlen, line, len);
+    c->outlen += len;
+}
+
+/* from the daemon thread, for requests that never reach the pool */
+static void daemon_error(struct daemon_client *c, const char *id, const char *reason) {
+    char line[128];
+    int len = snprintf(line, sizeof(line), "ERR %s %s\n", id, reason);
+    pthread_mutex_lock(&c->lock);
+    daemon_reply(c, line, (size_t)len);
+    pthread_mutex_unlock(&c->lock);
+}
+
+/* from the worker that ran the request */
+static void daemon_done(void *arg, uint64_t id, int status) {
+    struct daemon_client *c = arg;
+    char line[48];
+    int len = snprintf(line, sizeof(line), "DONE %" PRIu64 " %d\n", id, status == 0 ? 0 : 2);
+    pthread_mutex_lock(&c->lock);
+    daemon_reply(c, line, (size_t)len);
+    c->pending--;
+    pthread_mutex_unlock(&c->lock);
+    uint64_t one = 1;
+    if (write(daemon_wake, &one, sizeof(one)) < 0) {
+        /* only fails if the counter is about to overflow, and then the loop is awake anyway */
+    }
+}
+
+/* turn one request line into c->held; answers ERR and returns false if it is none */
+static bool daemon_parse(struct shred_pool *p, struct daemon_client *c, char *line) {
+    bool is_fd = strncmp(line, "FD ", 3) == 0;
+    char *arg = is_fd ? line + 3 : strncmp(line, "SHRED ", 6) == 0 ? line + 6 : NULL;
+    char *end = NULL;
+    uint64_t id = 0;
+    if (arg) {
+        errno = 0;
+        id = strtoull(arg, &end, 10);
+        if (errno || end == arg || (*end && *end != ' ')) arg = NULL;
+    }
+    if (!arg) {
+        daemon_error(c, "-", "malformed request");
+        return false;
+    }
+    char ids[24];
+    snprintf(ids, sizeof(ids), "%" PRIu64, id);
+    const char *rest = *end ? end + 1 : end;
+
+    struct shred_job job = {
+        .kind = is_fd ? JOB_FD : JOB_PATH, .owned = true, .fd = -1, .owner = c->uid, .done = daemon_done,
+        .done_arg = c, .id = id,
+    };
+    struct stat st;
+    char *name;
+    if (is_fd) {
+        if (c->nfds == 0) {
+            daemon_error(c, ids, "no descriptor passed");
+            return false;
+        }
+        job.fd = c->fds[c->fdhead];
+        c->fdhead = (c->fdhead + 1) % DAEMON_FDS;
+        c->nfds--;
+        /* the reopen through /proc would otherwise turn read access into write access */
+        int fl = fcntl(job.fd, F_GETFL);
+        if (c->uid && (fl < 0 || (fl & O_ACCMODE) == O_RDONLY)) {
+            close(job.fd);
+            daemon_error(c, ids, "descriptor not open for writing");
+            return false;
+        }
+        char fallback[32];
+        snprintf(fallback, sizeof(fallback), "fd request %" PRIu64, id);
+        name = strdup(*rest ? rest : fallback);
+        if (name && fstat(job.fd, &st) == 0) pool_place(p, &job, &st);
+    } else {
+        if (!*rest) {
+            daemon_error(c, ids, "no path");
+            return false;
+        }
+        /* refused early here; the worker checks the file it opens again */
+        bool known = stat(rest, &st) == 0;
+        if (known && c->uid && st.st_uid != c->uid) {
+            daemon_error(c, ids, "not owned by the client");
+            return false;
+        }
+        name = strdup(rest);
+        if (name && known) pool_place(p, &job, &st);
+    }
+    if (!name) {
+        if (is_fd) close(job.fd);
+        daemon_error(c, ids, "out of memory");
+        return false;
+    }
+    job.name = name;
+    c->held = job;
+    c->holding = true;
+    pthread_mutex_lock(&c->lock);
+    c->pending++;
+    pthread_mutex_unlock(&c->lock);
+    return true;
+}
+
+/* queue the client's buffered requests until the pool is full or a line is incomplete */
+static void daemon_feed(struct shred_pool *p, struct daemon_client *c) {
+    size_t used = 0;
+    for (;;) {
+        if (c->holding) {
+            if (!pool_offer(p, &c->held)) break;
+            c->holding = false;
+        }
+        char *line = c->in + used, *nl = memchr(line, '\n', c->inlen - used);
+        if (!nl) break;
+        *nl = '\0';
+        used += (size_t)(nl - line) + 1;
+        if (nl > line && nl[-1] == '\r') nl[-1] = '\0';
+        if (*line) daemon_parse(p, c, line);
+    }
+    memmove(c->in, c->in + used, c->inlen - used);
+    c->inlen -= used;
+    if (!c->holding && c->inlen == sizeof(c->in)) {
+        /* no newline in a whole buffer: nothing after it can be trusted either */
+        daemon_error(c, "-", "request too long");
+        c->inlen = 0;
+        c->eof = true;
+    }
+}
+
+/* read what the client sent, with any descriptors passed alongside */
+static void daemon_read(struct daemon_client *c) {
+    union {
+        struct cmsghdr h;
+        char buf[CMSG_SPACE(DAEMON_FDS * sizeof(int))];
+    } ctl;
+    struct iovec iov = { c->in + c->inlen, sizeof(c->in) - c->inlen };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctl.buf, .msg_controllen = sizeof(ctl.buf) };
+    ssize_t n = recvmsg(c->fd, &msg, MSG_CMSG_CLOEXEC);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); n >= 0 && cm; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+        size_t count = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; ++i) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cm) + i * sizeof(int), sizeof(fd));
+            if (c->nfds == DAEMON_FDS) {
+                close(fd); /* its FD line will get "no descriptor passed" */
+                continue;
+            }
+            c->fds[(c->fdhead + c->nfds++) % DAEMON_FDS] = fd;
+        }
+    }
+    if (n <= 0) c->eof = true;
+    else c->inlen += (size_t)n;
+}
+
+/* send the replies the workers could not */
+static void daemon_flush(struct daemon_client *c) {
+    pthread_mutex_lock(&c->lock);
+    if (c->outlen && !c->dead) {
+        ssize_t n = send(c->fd, c->out, c->outlen, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n > 0) {
+            memmove(c->out, c->out + n, c->outlen - (size_t)n);
+            c->outlen -= (size_t)n;
+        } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            c->dead = true;
+        }
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+/* a client is done with once it has nothing more to send, get or be told */
+static bool daemon_finished(struct daemon_client *c) {
+    pthread_mutex_lock(&c->lock);
+    bool done = c->eof && !c->holding && c->pending == 0 && (c->outlen == 0 || c->dead);
+    pthread_mutex_unlock(&c->lock);
+    return done;
+}
+
+static void daemon_close(struct daemon_client *c) {
+    for (size_t i = 0; i < c->nfds; ++i) close(c->fds[(c->fdhead + i) % DAEMON_FDS]);
+    close(c->fd);
+    pthread_mutex_destroy(&c->lock);
+    free(c->out);
+    free(c);
+}
+
+/*
+ * Bind the socket. A leftover socket file is replaced only if nothing accepts
+ * connections on it any more; a running daemon keeps its name.
+ */
+static int daemon_listen(const char *path) {
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+    size_t len = strlen(path);
+    if (len == 0 || len >= sizeof(sa.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(sa.sun_path, path, len);
+    if (path[0] == '@') sa.sun_path[0] = '\0';
+    socklen_t salen = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len + (path[0] == '@' ? 0 : 1));
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (path[0] != '@' && lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool live = probe >= 0 && connect(probe, (struct sockaddr *)&sa, salen) == 0;
+        if (probe >= 0) close(probe);
+        if (!live) unlink(path);
+    }
+    /* no one else gets to connect to the file; before the workers start, so the umask is ours */
+    mode_t mask = umask(0177);
+    int rc = bind(fd, (struct sockaddr *)&sa, salen);
+    umask(mask);
+    if (rc != 0 || listen(fd, SOMAXCONN) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+/* any_user: --daemon-any-user, take clients whatever their uid */
+static int run_daemon(const char *path, const struct shred_opts *o, int large_workers, bool any_user) {
+    bool verbose = o->verbose;
+    int lfd = daemon_listen(path);
+    if (lfd < 0) {
+        perror(path);
+        return 1;
+    }
+    daemon_wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (daemon_wake < 0) {
+        perror("eventfd");
+        return 1;
+    }
+    /* only the ppoll() below takes the stop signals; the workers never see them */
+    sigset_t stop, orig;
+    sigemptyset(&stop);
+    sigaddset(&stop, SIGINT);
+    sigaddset(&stop, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop, &orig);
+    struct sigaction sa = { .sa_handler = on_daemon_signal };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    struct shred_pool pool;
+    if (pool_start(&pool, o, large_workers, true) != 0) {
+        perror("--daemon: starting workers");
+        pool_finish(&pool);
+        return 1;
+    }
+    if (verbose)
+        fprintf(stderr, "Daemon: listening on %s with %d worker%s\n", path, pool.nthreads,
+                pool.nthreads == 1 ? "" : "s");
+
+    struct daemon_client **clients = NULL;
+    struct pollfd *pfd = NULL;
+    size_t nclients = 0, cap = 0, served = 0;
+    for (;;) {
+        if (daemon_stopping && lfd >= 0) {
+            close(lfd);
+            lfd = -1;
+            for (size_t i = 0; i < nclients; ++i) clients[i]->eof = true;
+        }
+        /* retire finished clients, queue what the others have buffered */
+        for (size_t i = 0; i < nclients;) {
+            daemon_feed(&pool, clients[i]);
+            if (daemon_finished(clients[i])) {
+                daemon_close(clients[i]);
+                clients[i] = clients[--nclients];
+            } else {
+                i++;
+            }
+        }
+        if (lfd < 0 && nclients == 0) break;
+
+        /* the wake and listen fds, every client, and room to accept one more */
+        if (nclients + 2 >= cap) {
+            size_t grown = (nclients + 2) * 2;
+            struct daemon_client **nc = realloc(clients, grown * sizeof(*clients));
+            if (nc) clients = nc;
+            struct pollfd *np = nc ? realloc(pfd, grown * sizeof(*pfd)) : NULL;
+            if (np) pfd = np;
+            if (!np) {
+                perror("realloc");
+                if (!pfd) break;
+            } else {
+                cap = grown;
+            }
+        }
+        pfd[0] = (struct pollfd){ .fd = daemon_wake, .events = POLLIN };
+        pfd[1] = (struct pollfd){ .fd = lfd, .events = POLLIN };
+        for (size_t i = 0; i < nclients; ++i) {
+            struct daemon_client *c = clients[i];
+            pthread_mutex_lock(&c->lock);
+            bool out = c->outlen && !c->dead;
+            pthread_mutex_unlock(&c->lock);
+            short events = (short)((!c->eof && !c->holding ? POLLIN : 0) | (out ? POLLOUT : 0));
+            /* nothing to wait for (a hangup would be reported regardless): the eventfd brings the next change */
+            pfd[2 + i] = (struct pollfd){ .fd = events ? c->fd : -1, .events = events };
+        }
+        if (ppoll(pfd, nclients + 2, NULL, &orig) < 0) {
+            if (errno == EINTR) continue;
+            perror("ppoll");
+            break;
+        }
+        if (pfd[0].revents & POLLIN) {
+            uint64_t v;
+            if (read(daemon_wake, &v, sizeof(v)) < 0) {
+                /* EAGAIN: another pass through the loop already drained it */
+            }
+        }
+        for (size_t i = 0; i < nclients; ++i) {
+            struct daemon_client *c = clients[i];
+            short rev = pfd[2 + i].revents;
+            if (rev & POLLOUT) daemon_flush(c);
+            if (rev & (POLLIN | POLLHUP | POLLERR) && !c->eof && !c->holding) daemon_read(c);
+            if (rev & POLLERR) {
+                pthread_mutex_lock(&c->lock);
+                c->dead = true;
+                pthread_mutex_unlock(&c->lock);
+            }
+        }
+        if (lfd >= 0 && pfd[1].revents & POLLIN) {
+            int cfd;
+            while (nclients + 2 < cap && (cfd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                struct ucred cred;
+                socklen_t credlen = sizeof(cred);
+                if (getsockopt(cfd, SOL_SOCKET, SO_PEERCRED, &cred, &credlen) != 0 ||
+                    (!any_user && cred.uid != geteuid())) {
+                    static const char refused[] = "ERR - permission denied\n";
+                    if (send(cfd, refused, sizeof(refused) - 1, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+                        /* it is being turned away either way */
+                    }
+                    if (verbose) fprintf(stderr, "Daemon: refused a client with uid %u\n", (unsigned)cred.uid);
+                    close(cfd);
+                    continue;
+                }
+                struct daemon_client *c = calloc(1, sizeof(*c));
+                if (!c) {
+                    perror("calloc");
+                    close(cfd);
+                    break;
+                }
+                c->fd = cfd;
+                c->uid = cred.uid;
+                pthread_mutex_init(&c->lock, NULL);
+                clients[nclients++] = c;
+                served++;
+            }
+        }
+    }
+
+    if (lfd >= 0) close(lfd);
+    if (path[0] != '@') unlink(path);
+    free(clients);
+    free(pfd);
+    pool_finish(&pool);
+    close(daemon_wake);
+    if (verbose)
+        fprintf(stderr, "Daemon: stopped after %zu request%s from %zu client%s, %zu failed\n", pool.files,
+                pool.files == 1 ? "" : "s", served, served == 1 ? "" : "s", pool.failed);
+    return 0;
+}
+
+/* "4096", "512K", "4M", "1G" -> bytes; 0 on error */
+static size_t parse_size(const char *arg) {
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull(arg, &end, 10);
+    if (errno || end == arg) return 0;
+    switch (*end) {
+        case 'k': case 'K': v <<= 10; end++; break;
+        case 'm': case 'M': v <<= 20; end++; break;
+        case 'g': case 'G': v <<= 30; end++; break;
+        default: break;
+    }
+    if (*end == 'i' && end[1] == 'B') end += 2;
+    else if (*end == 'B') end++;
+    if (*end) return 0;
+    return (size_t)v;
+}
+
+/*
+ * --bench DIR: create scratch files in DIR and run overwrite_file() on them
+ * under each backend, printing one JSON object per line on stdout:
+ *   "rng"       random generation alone, into a reused buffer
+ *   "io"        zero passes, i.e. the engine's write and sync path alone
+ *   "overwrite" -n random passes, as a real shred would run them
+ * -n, -S, -b, -Q and -H apply to every run; -z is ignored since the zero pass
+ * has its own rows. Each row is repeated --bench-runs times and reports
+ * percentiles over all passes of all runs.
+ */
+#define BENCH_MAX_SIZES 16
+
+struct bench_config {
+    const char *name;
+    enum shred_engine engine;
+    enum rng_mode rng;
+    bool direct;
+    unsigned pipeline;
+};
+
+static const struct bench_config bench_io[] = {
+    { "write",         ENGINE_WRITE, RNG_KERNEL, false, 0 },
+    { "direct",        ENGINE_WRITE, RNG_KERNEL, true,  0 },
+    { "uring",         ENGINE_URING, RNG_KERNEL, false, 0 },
+    { "uring+direct",  ENGINE_URING, RNG_KERNEL, true,  0 },
+    { "mmap",          ENGINE_MMAP,  RNG_KERNEL, false, 0 },
+};
+
+static const struct bench_config bench_overwrite[] = {
+    { "write",                 ENGINE_WRITE, RNG_KERNEL, false, 0 },
+    { "write+chacha",          ENGINE_WRITE, RNG_CHACHA, false, 0 },
+    { "write+chacha+pipeline", ENGINE_WRITE, RNG_CHACHA, false, 4 },
+    { "direct+chacha",         ENGINE_WRITE, RNG_CHACHA, true,  0 },
+    { "direct+chacha+pipeline", ENGINE_WRITE, RNG_CHACHA, true, 4 },
+    { "uring+chacha",          ENGINE_URING, RNG_CHACHA, false, 0 },
+    { "uring+chacha+direct",   ENGINE_URING, RNG_CHACHA, true,  0 },
+    { "mmap+chacha",           ENGINE_MMAP,  RNG_CHACHA, false, 0 },
+};
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* ,"key":{"min":..,"p50":..,"p90":..,"p99":..,"max":..} (nearest rank); sorts v */
+static void bench_print_dist(const char *key, double *v, size_t n) {
+    if (n == 0) return;
+    qsort(v, n, sizeof(double), cmp_double);
+    static const int pct[] = { 50, 90, 99 };
+    printf(",\"%s\":{\"min\":%.3f", key, v[0]);
+    for (size_t i = 0; i < sizeof(pct) / sizeof(pct[0]); ++i) {
+        size_t rank = ((size_t)pct[i] * n + 99) / 100;
+        printf(",\"p%d\":%.3f", pct[i], v[rank - 1]);
+    }
+    printf(",\"max\":%.3f}", v[n - 1]);
+}
+
+/* create dirfd/name with size bytes of allocated, non-zero data */
+/* page-aligned buffer, suitable for O_DIRECT on any logical block size up to a page */
+#define BUF_ALIGN 4096
+
+static void *alloc_aligned(size_t size, size_t align) {
+    void *p = NULL;
+    if (align < BUF_ALIGN) align = BUF_ALIGN;
+    int err = posix_memalign(&p, align, size);
+    if (err) {
+        fprintf(diag(), "posix_memalign(%zu) failed\n", size);
+        errno = err;
+        return NULL;
+    }
+    return p;
+}
+
+static int bench_create(int dirfd, const char *name, off_t size, size_t bufsize) {
+    int fd = openat(dirfd, name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        perror("bench: open");
+        return -1;
+    }
+    struct keystream ks;
+    unsigned char *buf = alloc_aligned(bufsize, BUF_ALIGN);
+    int rc = buf ? keystream_seed(&ks) : -1;
+    for (off_t off = 0; rc == 0 && off < size; off += (off_t)bufsize) {
+        size_t len = (off_t)bufsize < size - off ? bufsize : (size_t)(size - off);
+        keystream_fill(&ks, (uint64_t)off, buf, len);
+        if (pwrite_full(fd, buf, len, off) != 0) rc = -1;
+    }
+    if (rc == 0 && fsync(fd) != 0) rc = -1;
+    if (rc != 0) perror("bench: write");
+    explicit_bzero(&ks, sizeof(ks));
+    free(buf);
+    close(fd);
+    return rc;
+}
+
+static void bench_rng(const struct shred_opts *base, off_t size, size_t bufsize, int runs) {
+    static const struct { const char *name; enum rng_mode rng; } modes[] = {
+        { "kernel", RNG_KERNEL },
+        { "chacha", RNG_CHACHA },
+    };
+    unsigned char *buf = alloc_aligned(bufsize, BUF_ALIGN);
+    if (!buf) return;
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+        struct shred_opts o = *base;
+        o.rng = modes[m].rng;
+        double v[runs];
+        int n = 0;
+        for (int r = 0; r < runs; ++r) {
+            struct keystream ks;
+            double t0 = now_sec();
+            int rc = o.rng == RNG_CHACHA ? keystream_seed(&ks) : 0;
+            for (off_t off = 0; rc == 0 && off < size; off += (off_t)bufsize) {
+                size_t len = (off_t)bufsize < size - off ? bufsize : (size_t)(size - off);
+                rc = pass_random(o.rng, &ks, off, buf, len);
+            }
+            double dt = now_sec() - t0;
+            explicit_bzero(&ks, sizeof(ks));
+            if (rc == 0) v[n++] = dt > 0 ? (double)size / (1024.0 * 1024.0) / dt : 0.0;
+        }
+        printf("{\"bench\":\"rng\",\"rng\":\"%s\",\"size\":%" PRId64 ",\"chunk\":%zu,\"runs\":%d",
+               modes[m].name, (int64_t)size, bufsize, n);
+        bench_print_dist("mib_s", v, (size_t)n);
+        printf("}\n");
+    }
+    free(buf);
+}
+
+/* run every config in table against dirfd/name; returns the number of failed runs */
+static int bench_table(const char *kind, const struct bench_config *table, size_t n,
+                       const struct shred_opts *base, struct worker *w, int dirfd, const char *name,
+                       off_t size, int runs, bool have_direct) {
+    int failed = 0;
+    for (size_t c = 0; c < n; ++c) {
+        const struct bench_config *cfg = &table[c];
+        if (cfg->direct && !have_direct) continue;
+        struct shred_opts o = *base;
+        o.engine = cfg->engine;
+        o.rng = cfg->rng;
+        o.direct = cfg->direct;
+        o.pipeline = cfg->pipeline;
+        if (strcmp(kind, "io") == 0) {
+            o.passes = 0;
+            o.scheme = NULL;
+            o.pattern_max = 0;
+            o.final_zero = true;
+            o.zero_offload = false; /* time the engine, not fallocate() */
+        } else {
+            o.final_zero = false;
+        }
+
+        struct bench_stats stats = { 0 };
+        w->bench = &stats;
+        int ok = 0;
+        for (int r = 0; r < runs; ++r) {
+            if (overwrite_file(dirfd, name, name, AT_SYMLINK_NOFOLLOW, &o, w) >= 0) ok++;
+            else failed++;
+        }
+        w->bench = NULL;
+        /* without io_uring the rows would silently measure write() */
+        if (cfg->engine == ENGINE_URING && !w->ring_ready) {
+            free(stats.mib_s);
+            free(stats.sync_ms);
+            continue;
+        }
+
+        printf("{\"bench\":\"%s\",\"config\":\"%s\",\"size\":%" PRId64 ",\"chunk\":%zu,\"passes\":%d,"
+               "\"sync_every\":%d,\"runs\":%d",
+               kind, cfg->name, (int64_t)size, o.chunk, pass_count(&o), o.sync_every, ok);
+        bench_print_dist("mib_s", stats.mib_s, stats.npass);
+        bench_print_dist("sync_ms", stats.sync_ms, stats.nsync);
+        printf("}\n");
+        fflush(stdout);
+        free(stats.mib_s);
+        free(stats.sync_ms);
+    }
+    return failed;
+}
+
+/* parse the --bench-size list ("4K,64M,1G") into sizes; returns the count or 0 */
+static size_t bench_sizes(const char *arg, off_t sizes[BENCH_MAX_SIZES]) {
+    char *copy = strdup(arg);
+    if (!copy) return 0;
+    size_t n = 0;
+    char *save = NULL;
+    for (char *tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        size_t v = parse_size(tok);
+        if (v == 0 || n == BENCH_MAX_SIZES) {
+            n = 0;
+            break;
+        }
+        sizes[n++] = (off_t)v;
+    }
+    free(copy);
+    return n;
+}
+
+static int run_bench(const char *dir, const char *size_list, int runs, const struct shred_opts *o) {
+    off_t sizes[BENCH_MAX_SIZES];
+    size_t nsizes = bench_sizes(size_list, sizes);
+    if (nsizes == 0) {
+        fprintf(stderr, "invalid bench size list: %s (up to %d sizes, e.g. 4K,64M)\n", size_list,
+                BENCH_MAX_SIZES);
+        return 1;
+    }
+    int dirfd = open(dir, O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+    if (dirfd < 0) {
+        perror(dir);
+        return 1;
+    }
+
+    struct worker w = { 0 };
+    int failed = 0;
+    for (size_t i = 0; i < nsizes; ++i) {
+        char name[RANDOM_NAME_LEN + 1];
+        size_t bufsize = o->chunk ? o->chunk : CHUNK;
+        if (random_name(name) != 0 || bench_create(dirfd, name, sizes[i], bufsize) != 0) {
+            failed++;
+            continue;
+        }
+        if (o->verbose) fprintf(stderr, "Benchmarking %s/%s (%" PRId64 " bytes)\n", dir, name, (int64_t)sizes[i]);
+
+        int probe = openat(dirfd, name, O_WRONLY | O_DIRECT | O_CLOEXEC);
+        bool have_direct = probe >= 0;
+        if (probe >= 0) close(probe);
+
+        bench_rng(o, sizes[i], bufsize, runs);
+        failed += bench_table("io", bench_io, sizeof(bench_io) / sizeof(bench_io[0]), o, &w, dirfd, name,
+                              sizes[i], runs, have_direct);
+        failed += bench_table("overwrite", bench_overwrite, sizeof(bench_overwrite) / sizeof(bench_overwrite[0]),
+                              o, &w, dirfd, name, sizes[i], runs, have_direct);
+        if (unlinkat(dirfd, name, 0) != 0) perror("bench: unlink");
+    }
+    worker_release(&w);
+    close(dirfd);
+    return failed ? 2 : 0;
+}
+
+/*
+ * --free-space DIR: wipe the free blocks of DIR's filesystem. -j filler files
+ * grow concurrently, one segment at a time: fallocate() the segment, then run
+ * the normal passes over just that range (run_pass() sees the segment as the
+ * file's only extent). Segments are handed out under a lock that re-checks
+ * statvfs(), so the fill stops --reserve bytes short of full and never
+ * touches the root-reserved blocks. Once every filler has stopped, the files
+ * are fdatasynced and unlinked, which frees the space again.
+ */
+#define FILL_SEGMENT_CHUNKS 16
+
+struct fill_state {
+    const struct shred_opts *o;
+    int dirfd;
+    off_t reserve;              /* keep this much available to unprivileged users */
+    size_t unit;                /* write size, aligned for O_DIRECT */
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    bool full;                  /* reserve or ENOSPC reached: no more segments */
+    off_t pending;              /* granted but not preallocated (no fallocate support) */
+    uint64_t written;           /* bytes through every pass, for the progress line */
+    unsigned running;
+    int status;
+};
+
+struct filler {
+    struct fill_state *s;
+    char name[RANDOM_NAME_LEN + 1];
+    int fd;
+    bool direct;
+    pthread_t tid;
+};
+
+/* next segment of the filler at offset end, preallocated; 0 once the fill is over */
+static off_t fill_grant(struct fill_state *s, int fd, off_t end, bool *prealloc) {
+    off_t want = (off_t)s->unit * FILL_SEGMENT_CHUNKS, len = 0;
+    pthread_mutex_lock(&s->lock);
+    struct statvfs sv;
+    if (!s->full && !shred_interrupted && fstatvfs(s->dirfd, &sv) == 0) {
+        off_t avail = (off_t)sv.f_bavail * (off_t)sv.f_frsize - s->pending - s->reserve;
+        len = avail < want ? avail / (off_t)s->unit * (off_t)s->unit : want;
+    }
+    if (len > 0) {
+        *prealloc = fallocate(fd, 0, end, len) == 0;
+        if (!*prealloc && errno == ENOSPC) len = 0;
+        else if (!*prealloc) s->pending += len;
+    }
+    if (len <= 0) {
+        len = 0;
+        s->full = true;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return len;
+}
+
+static void *filler_main(void *arg) {
+    struct filler *fl = arg;
+    struct fill_state *s = fl->s;
+    const struct shred_opts *o = s->o;
+    struct worker w = { 0 };
+    struct shred_file f = {
+        .path = fl->name,
+        .o = o,
+        .w = &w,
+        .fd = fl->fd,
+        .direct = fl->direct,
+        .tail_fd = -1,
+        .bufsize = s->unit,
+        .next = 1,
+        .rng = o->rng,
+    };
+    f.ext = &f.whole;
+    bool use_uring = o->engine == ENGINE_URING && worker_uring(&w, o, s->unit) == 0;
+    size_t nbufs = (use_uring ? 0 : 1) + o->pattern_max;
+    unsigned char *bufs = nbufs ? arena_get(&w.arena, nbufs * s->unit) : NULL;
+    if (!use_uring) f.buf = bufs;
+    if (o->pattern_max && bufs) f.pattern = bufs + (use_uring ? 0 : s->unit);
+
+    bool verbose = o->verbose;
+    int status = nbufs && !bufs ? 2 : 0;
+    off_t end = 0, len;
+    bool prealloc;
+    while (status == 0 && (len = fill_grant(s, fl->fd, end, &prealloc)) > 0) {
+        f.whole = (struct extent){ end, end + len };
+        f.size = f.direct_end = end + len;
+        f.data_bytes = len;
+        int rc = 0;
+        for (int pass = 1; pass <= pass_count(o) && rc == 0; ++pass) {
+            struct pass_spec spec = pass_at(o, pass);
+            rc = run_pass(&f, &spec, use_uring, false);
+        }
+        int err = errno;
+
+        pthread_mutex_lock(&s->lock);
+        if (!prealloc) s->pending -= len;
+        if (rc == 0) s->written += (uint64_t)len * (uint64_t)pass_count(o);
+        else s->full = true;
+        pthread_mutex_unlock(&s->lock);
+        if (rc != 0) {
+            if (err != ENOSPC) status = 2; /* ENOSPC only means the estimate was off */
+            break;
+        }
+        end += len;
+    }
+    if (sync_and_check(fl->fd) != 0) {
+        if (verbose) diag_errno("sync");
+        status = 2;
+    }
+    explicit_bzero(&f.ks, sizeof(f.ks));
+    worker_release(&w);
+
+    pthread_mutex_lock(&s->lock);
+    if (status > s->status) s->status = status;
+    s->running--;
+    pthread_cond_signal(&s->changed);
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+static void fill_progress(struct fill_state *s, double t0, bool final) {
+    struct statvfs sv;
+    double left = fstatvfs(s->dirfd, &sv) == 0 ? (double)sv.f_bavail * (double)sv.f_frsize : 0;
+    double mib = (double)s->written / (1024.0 * 1024.0), dt = now_sec() - t0;
+    fprintf(stderr, "%s%.1f MiB written in %.1f s (%.1f MiB/s), %.1f MiB still free%s",
+            isatty(STDERR_FILENO) ? "\r" : "", mib, dt, dt > 0 ? mib / dt : 0.0, left / (1024.0 * 1024.0),
+            final || !isatty(STDERR_FILENO) ? "\n" : "");
+}
+
+static int run_free_space(const char *dir, off_t reserve, const struct shred_opts *o) {
+    bool verbose = o->verbose;
+    int dirfd = open(dir, O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+    struct statvfs sv;
+    struct stat st;
+    if (dirfd < 0 || fstatvfs(dirfd, &sv) != 0 || fstat(dirfd, &st) != 0) {
+        perror(dir);
+        if (dirfd >= 0) close(dirfd);
+        return 1;
+    }
+    if (reserve < 0) reserve = (off_t)(sv.f_blocks * sv.f_frsize / 100); /* default: 1% */
+
+    struct fill_state s = {
+        .o = o,
+        .dirfd = dirfd,
+        .reserve = reserve,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .changed = PTHREAD_COND_INITIALIZER,
+    };
+    struct statfs sf;
+    bool nocow = fstatfs(dirfd, &sf) == 0 && sf.f_type == FS_BTRFS;
+    size_t align = o->direct ? dio_alignment(&st) : 1;
+    s.unit = o->chunk ? o->chunk : auto_chunk(&st);
+    s.unit = (s.unit + align - 1) / align * align;
+    if (verbose)
+        fprintf(stderr, "Filling %s with %d file%s, keeping %" PRId64 " MiB free\n", dir, o->jobs,
+                o->jobs == 1 ? "" : "s", (int64_t)(reserve >> 20));
+
+    struct sigaction sa = { .sa_handler = on_stop_signal };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    unsigned n = (unsigned)o->jobs;
+    struct filler *fl = calloc(n, sizeof(*fl));
+    if (!fl) {
+        perror("calloc");
+        close(dirfd);
+        return 2;
+    }
+    unsigned started = 0;
+    for (unsigned i = 0; i < n; ++i) {
+        if (random_name(fl[i].name) != 0) break;
+        int flags = O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC;
+        fl[i].s = &s;
+        fl[i].direct = o->direct;
+        fl[i].fd = openat(dirfd, fl[i].name, flags | (o->direct ? O_DIRECT : 0), 0600);
+        if (fl[i].fd < 0 && o->direct && errno == EINVAL) {
+            fl[i].direct = false;
+            fl[i].fd = openat(dirfd, fl[i].name, flags, 0600);
+        }
+        if (fl[i].fd < 0) {
+            perror("open");
+            break;
+        }
+        /*
+         * btrfs: nodatacow while the filler is still empty, so every pass
+         * rewrites the same blocks instead of claiming new ones (and running
+         * out of space after the first)
+         */
+        int attr;
+        if (nocow && ioctl(fl[i].fd, FS_IOC_GETFLAGS, &attr) == 0) {
+            attr |= FS_NOCOW_FL;
+            if (ioctl(fl[i].fd, FS_IOC_SETFLAGS, &attr) != 0 && verbose) perror("ioctl(FS_IOC_SETFLAGS)");
+        }
+        pthread_mutex_lock(&s.lock);
+        s.running++;
+        pthread_mutex_unlock(&s.lock);
+        if (pthread_create(&fl[i].tid, NULL, filler_main, &fl[i]) != 0) {
+            s.running--;
+            close(fl[i].fd);
+            unlinkat(dirfd, fl[i].name, 0);
+            break;
+        }
+        started++;
+    }
+
+    /* live progress once a second until every filler has stopped */
+    double t0 = now_sec();
+    pthread_mutex_lock(&s.lock);
+    while (s.running) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += 1;
+        if (pthread_cond_timedwait(&s.changed, &s.lock, &ts) == ETIMEDOUT && s.running) {
+            pthread_mutex_unlock(&s.lock);
+            fill_progress(&s, t0, false);
+            pthread_mutex_lock(&s.lock);
+        }
+    }
+    pthread_mutex_unlock(&s.lock);
+    fill_progress(&s, t0, true);
+
+    int status = started ? s.status : 2;
+    for (unsigned i = 0; i < started; ++i) {
+        pthread_join(fl[i].tid, NULL);
+        if (close(fl[i].fd) != 0 && verbose) perror("close");
+        if (unlinkat(dirfd, fl[i].name, 0) != 0) {
+            perror("unlink");
+            status = 2;
+        }
+    }
+    if (fsync(dirfd) != 0 && verbose) perror("fsync(dir)");
+    if (shred_interrupted) {
+        fprintf(stderr, "Interrupted; filler files removed\n");
+        status = 2;
+    }
+    free(fl);
+    close(dirfd);
+    return status;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n passes] [-z] [-v] [-R kernel|chacha] [-j jobs]\n"
+                    "       [-e write|uring|mmap] [-Q depth] [-D] [-b size|auto] [-P buffers]\n"
+                    "       [-S pass|final|N] [-r] [-H] [-W writers] [-p] [--progress-json]\n"
+                    "       [--no-zero-offload] [--files-from list] [-0] [--journal file]\n"
+                    "       [--journal-interval size] [--verify] [--max-rate rate] [--adaptive]\n"
+                    "       [--idle] [--scheme dod|dod7|gutmann|list] [--stats json|csv]\n"
+                    "       [--cow warn|skip|force] [--discard[=secure]] [--numa]\n"
+                    "       [--schedule fifo|size] file...\n"
+                    "       %s --bench dir [--bench-size 4K,64M] [--bench-runs N] [options]\n"
+                    "       %s --free-space dir [--reserve size] [options]\n"
+                    "       %s --daemon socket [--daemon-any-user] [options]\n", prog, prog, prog, prog);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    struct shred_opts o = {
+        .passes = 3,
+        .final_zero = false,
+        .verbose = false,
+        .rng = RNG_KERNEL,
+        .jobs = 1,
+        .engine = ENGINE_WRITE,
+        .queue_depth = 16,
+        .direct = false,
+        .chunk = CHUNK,
+        .pipeline = 0,
+        .sync_every = 1,
+        .recursive = false,
+        .sparse = false,
+        .zero_offload = true,
+        .stripes = 0,
+        .cow = COW_WARN,
+    };
+    const char *bench_dir = NULL, *bench_size = "64M";
+    int bench_runs = 3;
+    const char *free_dir = NULL;
+    off_t free_reserve = -1;
+    enum {
+        OPT_BENCH = 256, OPT_BENCH_SIZE, OPT_BENCH_RUNS, OPT_NO_ZERO_OFFLOAD, OPT_FREE_SPACE, OPT_RESERVE,
+        OPT_PROGRESS_JSON, OPT_FILES_FROM, OPT_JOURNAL, OPT_JOURNAL_INTERVAL,
+        OPT_VERIFY, OPT_MAX_RATE, OPT_ADAPTIVE, OPT_IDLE, OPT_SCHEME, OPT_STATS, OPT_COW, OPT_DISCARD, OPT_NUMA, OPT_SCHEDULE,
+        OPT_DAEMON, OPT_DAEMON_ANY_USER,
+    };
+    struct pass_spec scheme[SCHEME_MAX];
+    bool idle = false, numa_opt = false, schedule_size = false, daemon_any_user = false;
+    const char *journal_path = NULL, *daemon_path = NULL, *journal_interval_arg = NULL;
+    off_t journal_interval = (off_t)1 << 30;
+    const char *files_from = NULL;
+    int delim = '\n';
+    static const struct option longopts[] = {
+        { "passes",  required_argument, NULL, 'n' },
+        { "zero",    no_argument,       NULL, 'z' },
+        { "verbose", no_argument,       NULL, 'v' },
+        { "rng",     required_argument, NULL, 'R' },
+        { "jobs",    required_argument, NULL, 'j' },
+        { "engine",  required_argument, NULL, 'e' },
+        { "queue-depth", required_argument, NULL, 'Q' },
+        { "direct",  no_argument,       NULL, 'D' },
+        { "block-size", required_argument, NULL, 'b' },
+        { "pipeline", required_argument, NULL, 'P' },
+        { "sync",    required_argument, NULL, 'S' },
+        { "recursive", no_argument,     NULL, 'r' },
+        { "sparse",  no_argument,       NULL, 'H' },
+        { "stripes", required_argument, NULL, 'W' },
+        { "progress", no_argument,      NULL, 'p' },
+        { "progress-json", no_argument, NULL, OPT_PROGRESS_JSON },
+        { "files-from", required_argument, NULL, OPT_FILES_FROM },
+        { "null",    no_argument,       NULL, '0' },
+        { "bench",   required_argument, NULL, OPT_BENCH },
+        { "bench-size", required_argument, NULL, OPT_BENCH_SIZE },
+        { "bench-runs", required_argument, NULL, OPT_BENCH_RUNS },
+        { "no-zero-offload", no_argument, NULL, OPT_NO_ZERO_OFFLOAD },
+        { "free-space", required_argument, NULL, OPT_FREE_SPACE },
+        { "reserve", required_argument, NULL, OPT_RESERVE },
+        { "journal", required_argument, NULL, OPT_JOURNAL },
+        { "journal-interval", required_argument, NULL, OPT_JOURNAL_INTERVAL },
+        { "verify",  no_argument,       NULL, OPT_VERIFY },
+        { "max-rate", required_argument, NULL, OPT_MAX_RATE },
+        { "adaptive", no_argument,      NULL, OPT_ADAPTIVE },
+        { "idle",    no_argument,       NULL, OPT_IDLE },
+        { "scheme",  required_argument, NULL, OPT_SCHEME },
+        { "stats",   required_argument, NULL, OPT_STATS },
+        { "cow",     required_argument, NULL, OPT_COW },
+        { "discard", optional_argument, NULL, OPT_DISCARD },
+        { "numa",    no_argument,       NULL, OPT_NUMA },
+        { "schedule", required_argument, NULL, OPT_SCHEDULE },
+        { "daemon",  required_argument, NULL, OPT_DAEMON },
+        { "daemon-any-user", no_argument, NULL, OPT_DAEMON_ANY_USER },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:zvR:j:e:Q:Db:P:S:rHW:p0", longopts, NULL)) != -1) {
+        switch (opt) {
+            case 'n': o.passes = atoi(optarg); if (o.passes < 1) o.passes = 1; break;
+            case 'z': o.final_zero = true; break;
+            case 'v': o.verbose = true; break;
+            case 'R':
+                if (strcmp(optarg, "kernel") == 0) o.rng = RNG_KERNEL;
+                else if (strcmp(optarg, "chacha") == 0) o.rng = RNG_CHACHA;
+                else {
+                    fprintf(stderr, "unknown rng: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'j':
+                o.jobs = atoi(optarg);
+                if (o.jobs <= 0) o.jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+                if (o.jobs < 1) o.jobs = 1;
+                break;
+            case 'e':
+                if (strcmp(optarg, "write") == 0) o.engine = ENGINE_WRITE;
+                else if (strcmp(optarg, "uring") == 0) o.engine = ENGINE_URING;
+                else if (strcmp(optarg, "mmap") == 0) o.engine = ENGINE_MMAP;
+                else {
+                    fprintf(stderr, "unknown engine: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'Q':
+                o.queue_depth = (unsigned)atoi(optarg);
+                if (o.queue_depth < 1) o.queue_depth = 1;
+                if (o.queue_depth > 1024) o.queue_depth = 1024;
+                break;
+            case 'D': o.direct = true; break;
+            case 'b':
+                if (strcmp(optarg, "auto") == 0) {
+                    o.chunk = 0;
+                    break;
+                }
+                o.chunk = parse_size(optarg);
+                if (o.chunk < 4096 || o.chunk > ((size_t)1 << 30)) {
+                    fprintf(stderr, "invalid block size: %s (4K..1G or auto)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'P':
+                o.pipeline = (unsigned)atoi(optarg);
+                if (o.pipeline < 2) o.pipeline = 2;
+                if (o.pipeline > 64) o.pipeline = 64;
+                break;
+            case 'S':
+                if (strcmp(optarg, "pass") == 0) o.sync_every = 1;
+                else if (strcmp(optarg, "final") == 0) o.sync_every = 0;
+                else if ((o.sync_every = atoi(optarg)) < 1) {
+                    fprintf(stderr, "invalid sync policy: %s (pass, final or N)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'r': o.recursive = true; break;
+            case 'H': o.sparse = true; break;
+            case 'W':
+                o.stripes = (unsigned)atoi(optarg);
+                if (o.stripes > 256) o.stripes = 256;
+                break;
+            case 'p': progress.human = true; break;
+            case OPT_PROGRESS_JSON: progress.json = true; break;
+            case OPT_FILES_FROM: files_from = optarg; break;
+            case '0': delim = '\0'; break;
+            case OPT_BENCH: bench_dir = optarg; break;
+            case OPT_BENCH_SIZE: bench_size = optarg; break;
+            case OPT_BENCH_RUNS:
+                bench_runs = atoi(optarg);
+                if (bench_runs < 1) bench_runs = 1;
+                break;
+            case OPT_NO_ZERO_OFFLOAD: o.zero_offload = false; break;
+            case OPT_FREE_SPACE: free_dir = optarg; break;
+            case OPT_RESERVE:
+                free_reserve = (off_t)parse_size(optarg);
+                if (free_reserve == 0 && strcmp(optarg, "0") != 0) {
+                    fprintf(stderr, "invalid reserve: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPT_JOURNAL: journal_path = optarg; break;
+            case OPT_VERIFY: o.verify = true; break;
+            case OPT_MAX_RATE:
+                throttle.cap = (double)parse_size(optarg);
+                if (throttle.cap <= 0) {
+                    fprintf(stderr, "invalid rate: %s (bytes per second, e.g. 200M)\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPT_ADAPTIVE: throttle.adaptive = true; break;
+            case OPT_IDLE: idle = true; break;
+            case OPT_NUMA: numa_opt = true; break;
+            case OPT_DAEMON: daemon_path = optarg; break;
+            case OPT_DAEMON_ANY_USER: daemon_any_user = true; break;
+            case OPT_SCHEDULE:
+                if (strcmp(optarg, "size") == 0) schedule_size = true;
+                else if (strcmp(optarg, "fifo") == 0) schedule_size = false;
+                else {
+                    fprintf(stderr, "unknown schedule: %s (fifo or size)\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPT_SCHEME:
+                o.scheme_len = parse_scheme(optarg, scheme, &o.pattern_max);
+                if (o.scheme_len <= 0) {
+                    fprintf(stderr, "invalid scheme: %s (dod, dod7, gutmann or e.g. 00,ff,random)\n", optarg);
+                    return 1;
+                }
+                o.scheme = scheme;
+                break;
+            case OPT_STATS:
+                stats.on = true;
+                if (strcmp(optarg, "csv") == 0) stats.csv = true;
+                else if (strcmp(optarg, "json") != 0) {
+                    fprintf(stderr, "unknown stats format: %s (json or csv)\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPT_COW:
+                if (strcmp(optarg, "warn") == 0) o.cow = COW_WARN;
+                else if (strcmp(optarg, "skip") == 0) o.cow = COW_SKIP;
+                else if (strcmp(optarg, "force") == 0) o.cow = COW_FORCE;
+                else {
+                    fprintf(stderr, "unknown cow policy: %s (warn, skip or force)\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPT_DISCARD:
+                if (!optarg) o.discard = DISCARD_ON;
+                else if (strcmp(optarg, "secure") == 0) o.discard = DISCARD_SECURE;
+                else {
+                    fprintf(stderr, "unknown discard mode: %s (--discard or --discard=secure)\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPT_JOURNAL_INTERVAL:
+                journal_interval = (off_t)parse_size(optarg);
+                journal_interval_arg = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    bool verbose = o.verbose;
+    /* once -b is known, whichever came first; -b auto may pick up to AUTO_CHUNK_MAX */
+    if (journal_interval_arg && journal_interval < (off_t)(o.chunk ? o.chunk : AUTO_CHUNK_MAX)) {
+        fprintf(stderr, "invalid journal interval: %s (at least the block size)\n", journal_interval_arg);
+        return 1;
+    }
+
+    throttle.on = throttle.cap > 0 || throttle.adaptive;
+    write_timed = throttle.adaptive || stats.on;
+    throttle.rate = throttle.cap;
+    if (verbose && throttle.on) {
+        if (throttle.cap > 0)
+            fprintf(stderr, "Rate limit: %.1f MiB/s across all writers%s\n", throttle.cap / (1024.0 * 1024.0),
+                    throttle.adaptive ? ", lower while the device is congested" : "");
+        else
+            fprintf(stderr, "Rate limit: adaptive, backing off while the device is congested\n");
+    }
+    /* before any thread exists, so every worker, stripe and filler inherits it */
+    if (idle && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) != 0)
+        perror("ioprio_set");
+
+    double t_start = now_sec();
+    if (stats.on) pthread_key_create(&stats.key, stats_release);
+
+    if (bench_dir) return run_bench(bench_dir, bench_size, bench_runs, &o);
+    if (free_dir) {
+        int status = run_free_space(free_dir, free_reserve, &o);
+        if (stats.on) stats_report(now_sec() - t_start);
+        return status;
+    }
+
+    if (daemon_path && (optind < argc || files_from || o.recursive || progress_on())) {
+        fprintf(stderr, "--daemon takes its paths from the socket: no files, --files-from, -r or -p\n");
+        return 1;
+    }
+    if (daemon_any_user && !daemon_path) {
+        fprintf(stderr, "--daemon-any-user needs --daemon\n");
+        return 1;
+    }
+    /* like xargs -0: a NUL-separated list on stdin needs no --files-from */
+    if (!files_from && delim == '\0' && optind >= argc && !daemon_path) files_from = "-";
+    if (optind >= argc && !files_from && !daemon_path) {
+        fprintf(stderr, "No files specified\n");
+        return 1;
+    }
+
+    if (verbose) {
+        if (o.sync_every == 1)
+            fprintf(stderr, "Sync policy: fdatasync after every pass\n");
+        else if (o.sync_every > 1)
+            fprintf(stderr, "Sync policy: fdatasync every %d passes and after the last, write-behind in between\n",
+                    o.sync_every);
+        else
+            fprintf(stderr, "Sync policy: fdatasync after the last pass only, write-behind in between\n");
+    }
+
+    if (journal_path) {
+        if (journal_open(journal_path, journal_interval) != 0) {
+            perror(journal_path);
+            return 1;
+        }
+        if (verbose) {
+            size_t n = journal.nrecs;
+            fprintf(stderr, "Journal %s: %zu unfinished file%s\n", journal_path, n, n == 1 ? "" : "s");
+        }
+        /* finish the current chunk, checkpoint it and stop taking new files */
+        struct sigaction sa = { .sa_handler = on_stop_signal, .sa_flags = SA_RESTART };
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+    }
+
+    /* Seed for fallback name changes */
+    srand((unsigned)time(NULL) ^ (unsigned)getpid());
+
+    if (daemon_path) {
+        /* requests come and go, so --schedule size keeps half the workers for large files */
+        if (numa_opt && o.jobs > 1) numa_init(verbose);
+        int status = run_daemon(daemon_path, &o, schedule_size && o.jobs > 1 ? o.jobs / 2 : 0, daemon_any_user);
+        if (stats.on) stats_report(now_sec() - t_start);
+        return status;
+    }
+
+    size_t nfiles = (size_t)(argc - optind);
+    if (!o.recursive && !files_from && (size_t)o.jobs > nfiles) o.jobs = (int)nfiles;
+    if (o.recursive) {
+        /* every directory with pending children holds an fd */
+        struct rlimit rl;
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+            rl.rlim_cur = rl.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &rl);
+        }
+    }
+
+    if (progress_on()) {
+        /* the overall target is known up front unless -r or a --files-from stream has more to come */
+        int64_t total = 0;
+        for (int i = optind; i < argc && !o.recursive; ++i) total += path_bytes(argv[i]);
+        progress_start((unsigned)o.jobs + 1, total * pass_count(&o),
+                       !o.recursive && !files_from);
+    }
+
+    int large_workers = 0;
+    if (schedule_size && o.jobs > 1) large_workers = schedule_paths(argv + optind, nfiles, o.jobs, files_from, verbose);
+    if (numa_opt && o.jobs > 1) numa_init(verbose);
+    struct shred_pool pool;
+    pool_start(&pool, &o, large_workers, false);
+    for (int i = optind; i < argc && !shred_interrupted; ++i) pool_submit(&pool, argv[i], false);
+    if (files_from && submit_stream(&pool, files_from, delim, verbose) != 0) pool_error(&pool);
+    int exit_status = pool_finish(&pool);
+    if (progress_on()) progress_finish();
+    if (shred_interrupted) fprintf(stderr, "Interrupted; run again with --journal %s to resume\n", journal_path);
+    if (stats.on) stats_report(now_sec() - t_start);
+
+    size_t unverified = atomic_load(&verify_failures);
+    if (unverified) {
+        fprintf(stderr, "%zu file%s failed verification\n", unverified, unverified == 1 ? "" : "s");
+        exit_status = 2;
+    }
+
+    if (verbose && (pool.files > 1 || o.recursive))
+        fprintf(stderr, "Done: %zu files, %zu failed\n", pool.files, pool.failed);
+    return exit_status;
+}
+#endif /* SHREDDER_LIBRARY */
@@ -0,0 +1,99 @@
+/*
+ * shredder.h
+ * In-process API to the shredder overwrite pipeline
+ *
+ * Build the library from the same source as the command line:
+ *   gcc -O2 -std=c11 -Wall -Wextra -pthread -fPIC -DSHREDDER_LIBRARY -c shredder.c -o libshredder.o
+ *   ar rcs libshredder.a libshredder.o
+ * or as a shared object:
+ *   gcc -O2 -std=c11 -Wall -Wextra -pthread -fPIC -DSHREDDER_LIBRARY -shared -o libshredder.so shredder.c
+ * and link the caller with -lshredder -pthread. The header works from C and C++.
+ *
+ * Every call does what the command line does for one file with the matching
+ * options, including rename and unlink for paths. Failures are -1; what went
+ * wrong is written to opts.log, with opts.verbose for the per-pass detail.
+ */
+#ifndef SHREDDER_H
+#define SHREDDER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum shredder_rng {
+    SHREDDER_RNG_KERNEL,        /* -R kernel: getrandom() for every chunk */
+    SHREDDER_RNG_CHACHA,        /* -R chacha: ChaCha20 seeded once per pass */
+};
+
+enum shredder_engine {
+    SHREDDER_ENGINE_WRITE,      /* -e write: blocking pwrite() */
+    SHREDDER_ENGINE_URING,      /* -e uring: queued io_uring writes, linked fsync */
+    SHREDDER_ENGINE_MMAP,       /* -e mmap: shared mapping windows, files only */
+};
+
+/*
+ * bytes of path just written, out of total for all of its passes. Called from
+ * the thread doing the writes once per chunk (concurrently from a block
+ * device's stripe writers), so it should only add the bytes up.
+ */
+typedef void (*shredder_progress_fn)(void *arg, const char *path, uint64_t bytes, uint64_t total);
+
+/* request id finished: status 0, or -1 if it failed. Called from a pool thread. */
+typedef void (*shredder_done_fn)(void *arg, uint64_t id, int status);
+
+struct shredder_opts {
+    int passes;                 /* -n: random passes (default 3) */
+    bool zero;                  /* -z: final zero pass */
+    const char *scheme;         /* --scheme: "dod", "gutmann", "00,ff,random", ... instead of passes; NULL = none */
+    int sync_every;             /* -S: fdatasync every N passes, 0 = last pass only (default 1) */
+    enum shredder_rng rng;      /* -R (default kernel) */
+    enum shredder_engine engine; /* -e (default write) */
+    unsigned queue_depth;       /* -Q: io_uring writes in flight (default 16) */
+    size_t block_size;          /* -b: write size, 4K..1G (default 0 = 1M) */
+    bool direct;                /* -D: O_DIRECT */
+    bool sparse;                /* -H: overwrite allocated extents only, punch the holes */
+    bool discard;               /* --discard: punch the blocks out after the last pass */
+    bool verbose;               /* -v */
+    FILE *log;                  /* messages; NULL = stderr */
+    shredder_progress_fn progress; /* NULL = none */
+    void *progress_arg;
+};
+
+/* the command line's defaults */
+void shredder_opts_init(struct shredder_opts *opts);
+
+/*
+ * Shred on the calling thread and return 0 or -1. Each thread keeps its
+ * buffers and io_uring ring until it exits, so a caller's own thread pool
+ * reuses them from file to file; a call with a larger block_size or a
+ * different queue_depth than the last one regrows them first.
+ * shredder_path() overwrites, renames and unlinks path; shredder_fd()
+ * overwrites the file behind fd and leaves its name, if any, alone.
+ */
+int shredder_path(const char *path, const struct shredder_opts *opts);
+int shredder_fd(int fd, const struct shredder_opts *opts);
+
+/*
+ * A pool of threads (0 = one per CPU) shredding with opts, copied here, in
+ * the background. Submitting waits only while the pool's queue is full; fd is
+ * duplicated, so the caller may close its own. done is called once per
+ * request, in completion order. shredder_close() waits for every request
+ * and returns 0 if all of them succeeded, else -1. Submitting is thread-safe.
+ */
+struct shredder;
+
+struct shredder *shredder_open(const struct shredder_opts *opts, int threads);
+int shredder_submit_path(struct shredder *s, const char *path, uint64_t id, shredder_done_fn done, void *arg);
+int shredder_submit_fd(struct shredder *s, int fd, uint64_t id, shredder_done_fn done, void *arg);
+int shredder_close(struct shredder *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SHREDDER_H */
@@ -0,0 +1,79 @@
+/*
+ * --daemon client for tests/smoke.sh: sends the request lines read from stdin
+ * to the daemon's socket and prints the replies once the daemon has answered
+ * them all. "FD <id> <file>" opens file for writing and passes the descriptor
+ * with the line (SCM_RIGHTS); every other line is sent as it is.
+ *
+ *   daemon_client socket < requests
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static int send_line(int s, const char *line, int fd) {
+    struct iovec iov = { (void *)line, strlen(line) };
+    union {
+        struct cmsghdr h;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctl;
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+    if (fd >= 0) {
+        msg.msg_control = ctl.buf;
+        msg.msg_controllen = sizeof(ctl.buf);
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cm), &fd, sizeof(fd));
+    }
+    return sendmsg(s, &msg, MSG_NOSIGNAL) == (ssize_t)iov.iov_len ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s socket < requests\n", argv[0]);
+        return 1;
+    }
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+    size_t len = strlen(argv[1]);
+    if (len >= sizeof(sa.sun_path)) {
+        fprintf(stderr, "%s: name too long\n", argv[1]);
+        return 1;
+    }
+    memcpy(sa.sun_path, argv[1], len);
+    if (argv[1][0] == '@') sa.sun_path[0] = '\0';
+    socklen_t salen = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len + (argv[1][0] == '@' ? 0 : 1));
+    int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (s < 0 || connect(s, (struct sockaddr *)&sa, salen) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    char line[4200];
+    while (fgets(line, sizeof(line), stdin)) {
+        int fd = -1;
+        char file[4096];
+        if (sscanf(line, "FD %*s %4095[^\n]", file) == 1 && (fd = open(file, O_WRONLY | O_CLOEXEC)) < 0) {
+            perror(file);
+            return 1;
+        }
+        int rc = send_line(s, line, fd);
+        if (fd >= 0) close(fd);
+        if (rc != 0) {
+            perror("sendmsg");
+            return 1;
+        }
+    }
+    shutdown(s, SHUT_WR);
+
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(s, buf, sizeof(buf))) > 0) fwrite(buf, 1, (size_t)n, stdout);
+    close(s);
+    return n < 0 ? 1 : 0;
+}
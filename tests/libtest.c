@@ -0,0 +1,164 @@
+/*
+ * Library API tests: linked against libshredder.a exactly as a caller would
+ * be, so only shredder.h is visible.
+ *
+ *   make check
+ */
+#define _GNU_SOURCE
+#include "../shredder.h"
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int failures;
+
+#define CHECK(cond)                                                             \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                         \
+        }                                                                       \
+    } while (0)
+
+static char dir[] = "/tmp/shredder-lib-XXXXXX";
+
+/* dir/name filled with size bytes of 0xa5; returns its path in a static buffer */
+static const char *make_file(const char *name, size_t size) {
+    static char path[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    CHECK(fd >= 0);
+    char buf[4096];
+    memset(buf, 0xa5, sizeof(buf));
+    for (size_t done = 0; done < size; done += sizeof(buf)) {
+        size_t n = size - done < sizeof(buf) ? size - done : sizeof(buf);
+        CHECK(write(fd, buf, n) == (ssize_t)n);
+    }
+    close(fd);
+    return path;
+}
+
+static bool all_zero(int fd, size_t size) {
+    char buf[4096];
+    for (off_t off = 0; off < (off_t)size;) {
+        ssize_t n = pread(fd, buf, sizeof(buf), off);
+        if (n <= 0) return false;
+        for (ssize_t i = 0; i < n; ++i)
+            if (buf[i]) return false;
+        off += n;
+    }
+    return true;
+}
+
+static atomic_ullong progress_bytes;
+
+static void on_progress(void *arg, const char *path, uint64_t bytes, uint64_t total) {
+    (void)arg;
+    (void)path;
+    (void)total;
+    atomic_fetch_add(&progress_bytes, bytes);
+}
+
+static atomic_int done_ok, done_failed;
+static atomic_ullong done_ids;
+
+static void on_done(void *arg, uint64_t id, int status) {
+    (void)arg;
+    atomic_fetch_add(status == 0 ? &done_ok : &done_failed, 1);
+    atomic_fetch_or(&done_ids, 1ull << id);
+}
+
+static void test_sync_calls(void) {
+    struct shredder_opts o;
+    shredder_opts_init(&o);
+    CHECK(o.passes == 3 && !o.zero && o.engine == SHREDDER_ENGINE_WRITE);
+    o.passes = 2;
+    o.rng = SHREDDER_RNG_CHACHA;
+    o.progress = on_progress;
+
+    char path[256];
+    snprintf(path, sizeof(path), "%s", make_file("sync", 100000));
+    CHECK(shredder_path(path, &o) == 0);
+    CHECK(access(path, F_OK) != 0);
+    CHECK(atomic_load(&progress_bytes) == 2 * 100000);
+
+    /* an fd is overwritten and left where it is */
+    snprintf(path, sizeof(path), "%s", make_file("byfd", 50000));
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    o.zero = true;
+    o.block_size = 8192;
+    CHECK(shredder_fd(fd, &o) == 0);
+    struct stat st;
+    CHECK(access(path, F_OK) == 0 && fstat(fd, &st) == 0 && st.st_size == 50000);
+    CHECK(all_zero(fd, 50000));
+    close(fd);
+    unlink(path);
+
+    FILE *quiet = fopen("/dev/null", "w");
+    o.log = quiet;
+    CHECK(shredder_path("/nonexistent/shredder-lib", &o) == -1);
+    o.scheme = "00,zz";
+    snprintf(path, sizeof(path), "%s", make_file("scheme", 10));
+    CHECK(shredder_path(path, &o) == -1);
+    CHECK(access(path, F_OK) == 0); /* refused before it is touched */
+    o.scheme = "dod";
+    CHECK(shredder_path(path, &o) == 0);
+    fclose(quiet);
+}
+
+static void test_pool(void) {
+    struct shredder_opts o;
+    shredder_opts_init(&o);
+    o.passes = 1;
+    o.engine = SHREDDER_ENGINE_URING;
+    FILE *quiet = fopen("/dev/null", "w");
+    o.log = quiet;
+    struct shredder *s = shredder_open(&o, 3);
+    CHECK(s != NULL);
+    if (!s) return;
+    for (int i = 1; i <= 8; ++i) {
+        char name[16];
+        snprintf(name, sizeof(name), "p%d", i);
+        CHECK(shredder_submit_path(s, make_file(name, (size_t)i * 30000), (uint64_t)i, on_done, NULL) == 0);
+    }
+    int fd = open(make_file("pfd", 70000), O_RDWR | O_CLOEXEC);
+    CHECK(shredder_submit_fd(s, fd, 9, on_done, NULL) == 0);
+    close(fd); /* the pool has its own copy */
+    CHECK(shredder_submit_path(s, "/nonexistent/shredder-lib", 10, on_done, NULL) == 0);
+    CHECK(shredder_close(s) == -1); /* one of them failed */
+    CHECK(atomic_load(&done_ok) == 9 && atomic_load(&done_failed) == 1);
+    CHECK(atomic_load(&done_ids) == 0x7fe);
+    for (int i = 1; i <= 8; ++i) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/p%d", dir, i);
+        CHECK(access(path, F_OK) != 0);
+    }
+    char path[256];
+    snprintf(path, sizeof(path), "%s/pfd", dir);
+    CHECK(access(path, F_OK) == 0);
+    unlink(path);
+    fclose(quiet);
+}
+
+int main(void) {
+    if (!mkdtemp(dir)) {
+        perror(dir);
+        return 1;
+    }
+    test_sync_calls();
+    test_pool();
+    char path[256];
+    snprintf(path, sizeof(path), "%s/scheme", dir);
+    unlink(path);
+    CHECK(rmdir(dir) == 0);
+    if (failures) {
+        fprintf(stderr, "%d check%s failed\n", failures, failures == 1 ? "" : "s");
+        return 1;
+    }
+    printf("libtest: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,118 @@
+#!/bin/sh
+# End-to-end checks of the command-line modes on scratch files.
+#
+#   tests/smoke.sh ./shredder
+set -u
+
+tests=$(cd "$(dirname "$0")" && pwd)
+bin=$(cd "$(dirname "${1:-./shredder}")" && pwd)/$(basename "${1:-./shredder}")
+work=$(mktemp -d "${TMPDIR:-/tmp}/shredder-smoke.XXXXXX") || exit 1
+trap 'rm -rf "$work"' EXIT
+failures=0
+
+fail() {
+    echo "smoke: $*" >&2
+    failures=$((failures + 1))
+}
+
+# fill <file> <KiB>
+fill() {
+    head -c "$(($2 * 1024))" /dev/urandom > "$1"
+}
+
+# true if <file> holds nothing but zero bytes
+all_zero() {
+    [ -z "$(tr -d '\000' < "$1" | head -c 1)" ]
+}
+
+# -r: a tree is overwritten, every file unlinked and every directory removed
+mkdir -p "$work/tree/a/b" "$work/tree/c"
+for i in 1 2 3 4 5; do
+    fill "$work/tree/f$i" 4
+    fill "$work/tree/a/g$i" 1
+    fill "$work/tree/a/b/h$i" 9
+done
+: > "$work/tree/c/empty"
+"$bin" -r -j 3 -n 1 "$work/tree" || fail "-r exited with $?"
+[ -e "$work/tree" ] && fail "-r left $(find "$work/tree" | wc -l) entries behind"
+
+# command-line and --files-from paths, unlinked in batches per directory: all gone
+mkdir "$work/flat" "$work/flat2"
+for i in $(seq 1 300); do echo "$i" > "$work/flat/f$i"; echo "$i" > "$work/flat2/f$i"; done
+"$bin" -j 2 -n 1 "$work/flat"/* || fail "paths exited with $?"
+[ -z "$(ls -A "$work/flat")" ] || fail "paths left $(ls -A "$work/flat" | wc -l) files behind"
+find "$work/flat2" -type f -print0 | "$bin" -n 1 -0 --files-from - || fail "--files-from exited with $?"
+[ -z "$(ls -A "$work/flat2")" ] || fail "--files-from left $(ls -A "$work/flat2" | wc -l) files behind"
+
+# --journal: SIGTERM stops at a checkpoint, and the same journal resumes from it
+mkdir "$work/jr"
+fill "$work/jr/big" 32768
+"$bin" -n 2 --journal "$work/jr/j" --journal-interval 1M --max-rate 16M "$work/jr/big" 2>/dev/null &
+pid=$!
+sleep 1
+kill -TERM "$pid"
+wait "$pid"
+[ $? -eq 2 ] || fail "an interrupted --journal run did not exit with 2"
+[ -e "$work/jr/big" ] || fail "an interrupted --journal run removed its file"
+"$bin" -v -n 2 --journal "$work/jr/j" --journal-interval 1M "$work/jr/big" 2> "$work/jr/log" ||
+    fail "resuming exited with $?"
+grep -q "^Resuming .*big at pass 1, offset [1-9]" "$work/jr/log" || fail "--journal did not resume mid-pass"
+[ -e "$work/jr/big" ] && fail "the resumed file was left"
+[ "$(tail -n 1 "$work/jr/j" | cut -c1)" = D ] || fail "the journal does not end with the file done"
+
+# -e uring: a second hard link keeps the inode, so the passes can be read back
+mkdir "$work/ur"
+for i in 1 2 3; do
+    fill "$work/ur/f$i" $((i * 700))
+    ln "$work/ur/f$i" "$work/ur/keep$i"
+done
+"$bin" -v -e uring -Q 8 -j 2 -z --no-zero-offload "$work/ur"/f* 2> "$work/ur/log" || fail "-e uring exited with $?"
+grep -q "falling back to write()" "$work/ur/log" && echo "smoke: io_uring unavailable, -e uring ran on write()" >&2
+for i in 1 2 3; do
+    [ -e "$work/ur/f$i" ] && fail "-e uring left f$i"
+    all_zero "$work/ur/keep$i" || fail "-e uring did not zero f$i"
+done
+
+# --verify: a random and a pattern last pass read back as written
+mkdir "$work/vf"
+fill "$work/vf/rand" 3000
+fill "$work/vf/dod" 1000
+"$bin" -v --verify -j 2 "$work/vf/rand" 2> "$work/vf/log" || fail "--verify exited with $?"
+"$bin" -v --verify --scheme 00,ff "$work/vf/dod" 2>> "$work/vf/log" || fail "--verify --scheme exited with $?"
+[ "$(grep -c "^Verified " "$work/vf/log")" -eq 2 ] || fail "--verify did not verify both files"
+[ -z "$(ls -A "$work/vf" | grep -v log)" ] || fail "--verify left files behind"
+
+# --daemon: a path and a descriptor passed with SCM_RIGHTS, each answered DONE
+mkdir "$work/dm"
+fill "$work/dm/path" 100
+fill "$work/dm/byfd" 100
+"$bin" --daemon "$work/dm/sock" -j 2 -z --no-zero-offload 2>/dev/null &
+pid=$!
+for i in $(seq 1 50); do [ -S "$work/dm/sock" ] && break; sleep 0.1; done
+if [ -S "$work/dm/sock" ]; then
+    [ "$(stat -c %a "$work/dm/sock")" = 600 ] || fail "--daemon socket is mode $(stat -c %a "$work/dm/sock")"
+    printf 'SHRED 1 %s\nFD 2 %s\nSHRED 3 %s\nHELLO\n' "$work/dm/path" "$work/dm/byfd" "$work/dm/missing" |
+        "$tests/daemon_client" "$work/dm/sock" | sort > "$work/dm/replies"
+    printf 'DONE 1 0\nDONE 2 0\nDONE 3 2\nERR - malformed request\n' | diff - "$work/dm/replies" >&2 ||
+        fail "--daemon replied differently"
+    [ -e "$work/dm/path" ] && fail "--daemon left the SHRED path"
+    all_zero "$work/dm/byfd" || fail "--daemon did not zero the FD file"
+    kill -TERM "$pid"
+    wait "$pid" || fail "--daemon exited with $? on SIGTERM"
+    [ -e "$work/dm/sock" ] && fail "--daemon left its socket"
+else
+    fail "--daemon did not create its socket"
+    kill "$pid"
+fi
+
+# a missing file fails the run but not the others
+fill "$work/other" 1
+"$bin" -n 1 "$work/missing" "$work/other" 2>/dev/null
+[ $? -eq 2 ] || fail "a missing file did not make the exit status 2"
+[ -e "$work/other" ] && fail "the file after a missing one was left"
+
+if [ "$failures" -ne 0 ]; then
+    echo "smoke: $failures check(s) failed" >&2
+    exit 1
+fi
+echo "smoke: all checks passed"
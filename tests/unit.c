@@ -0,0 +1,262 @@
+/*
+ * Unit tests for the parts of shredder.c that can be checked without a disk:
+ * the ChaCha20 keystream and other pure helpers. The source is included
+ * whole so that its static functions are reachable; its main() is renamed.
+ *
+ *   make check
+ */
+#define main shredder_main
+#include "../shredder.c"
+#undef main
+
+static int failures;
+
+#define CHECK(cond)                                                             \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                         \
+        }                                                                       \
+    } while (0)
+
+/*
+ * RFC 8439 section 2.3.2. The RFC's state has a 32-bit counter and a 96-bit
+ * nonce; here words 12-13 are the counter and 14-15 the nonce, so the RFC's
+ * counter and first nonce word make up the 64-bit counter.
+ */
+static void test_chacha20_rfc8439(void) {
+    static const unsigned char want[64] = {
+        0x10, 0xf1, 0xe7, 0xe4, 0xd1, 0x3b, 0x59, 0x15, 0x50, 0x0f, 0xdd, 0x1f, 0xa3, 0x20, 0x71, 0xc4,
+        0xc7, 0xd1, 0xf4, 0xc7, 0x33, 0xc0, 0x68, 0x03, 0x04, 0x22, 0xaa, 0x9a, 0xc3, 0xd4, 0x6c, 0x4e,
+        0xd2, 0x82, 0x64, 0x46, 0x07, 0x9f, 0xaa, 0x09, 0x14, 0xc2, 0xd7, 0x05, 0xd9, 0x8b, 0x02, 0xa2,
+        0xb5, 0x12, 0x9c, 0xd1, 0xde, 0x16, 0x4e, 0xb9, 0xcb, 0xd0, 0x83, 0xe8, 0xa2, 0x50, 0x3c, 0x4e,
+    };
+    struct keystream ks = { .nonce = 0x4a000000 };
+    for (int i = 0; i < 8; ++i) {
+        unsigned char b = (unsigned char)(4 * i);
+        ks.key[i] = (uint32_t)b | (uint32_t)(b + 1) << 8 | (uint32_t)(b + 2) << 16 | (uint32_t)(b + 3) << 24;
+    }
+    unsigned char out[CHACHA_BATCH];
+    chacha20_blocks(&ks, 1 | (uint64_t)0x09000000 << 32, out);
+    CHECK(memcmp(out, want, sizeof(want)) == 0);
+}
+
+/* any range of the keystream must match the same bytes of one long fill */
+static void test_keystream_offsets(void) {
+    struct keystream ks;
+    CHECK(keystream_seed(&ks) == 0);
+    enum { TOTAL = 8 * CHACHA_BATCH + 100 };
+    static unsigned char whole[TOTAL], part[TOTAL];
+    keystream_fill(&ks, 0, whole, TOTAL);
+    static const size_t ranges[][2] = {
+        { 0, 1 }, { 1, 63 }, { 63, 2 }, { 64, 64 }, { 100, CHACHA_BATCH },
+        { CHACHA_BATCH - 1, CHACHA_BATCH + 2 }, { 3 * CHACHA_BATCH, 5 * CHACHA_BATCH }, { 5, TOTAL - 5 },
+    };
+    for (size_t i = 0; i < sizeof(ranges) / sizeof(ranges[0]); ++i) {
+        size_t off = ranges[i][0], len = ranges[i][1];
+        memset(part, 0, len);
+        keystream_fill(&ks, off, part, len);
+        CHECK(memcmp(part, whole + off, len) == 0);
+    }
+    /* a different nonce is a different stream */
+    struct keystream other = ks;
+    other.nonce++;
+    keystream_fill(&other, 0, part, 64);
+    CHECK(memcmp(part, whole, 64) != 0);
+}
+
+static void test_parse_scheme(void) {
+    struct pass_spec sp[SCHEME_MAX];
+    unsigned pmax;
+    CHECK(parse_scheme("dod", sp, &pmax) == 3);
+    CHECK(sp[0].kind == PASS_PATTERN && sp[0].len == 1 && sp[0].pattern[0] == 0x00);
+    CHECK(sp[1].kind == PASS_PATTERN && sp[1].pattern[0] == 0xff);
+    CHECK(sp[2].kind == PASS_RANDOM);
+    CHECK(pmax == 1);
+    CHECK(parse_scheme("dod7", sp, &pmax) == 7);
+    CHECK(parse_scheme("gutmann", sp, &pmax) == 35);
+    CHECK(pmax == 3);
+    CHECK(sp[6].len == 3 && sp[6].pattern[0] == 0x92 && sp[6].pattern[1] == 0x49 && sp[6].pattern[2] == 0x24);
+
+    CHECK(parse_scheme("0xAB,random,1234", sp, &pmax) == 3);
+    CHECK(sp[0].len == 1 && sp[0].pattern[0] == 0xab);
+    CHECK(sp[2].len == 2 && sp[2].pattern[0] == 0x12 && sp[2].pattern[1] == 0x34);
+    CHECK(pmax == 2);
+
+    CHECK(parse_scheme("", sp, &pmax) == 0);
+    CHECK(parse_scheme("0", sp, &pmax) == -1);        /* odd digit count */
+    CHECK(parse_scheme("0x", sp, &pmax) == -1);
+    CHECK(parse_scheme("12345678", sp, &pmax) == -1); /* longer than PATTERN_MAX */
+    CHECK(parse_scheme("zz", sp, &pmax) == -1);
+    CHECK(parse_scheme("00,", sp, &pmax) == -1);
+    CHECK(parse_scheme("randomx", sp, &pmax) == -1);
+    char many[4 * (SCHEME_MAX + 1)] = "";
+    for (int i = 0; i <= SCHEME_MAX; ++i) strcat(many, i ? ",00" : "00");
+    CHECK(parse_scheme(many, sp, &pmax) == -1);
+
+    /* a pattern stays in phase from any file offset */
+    struct pass_spec g = { .kind = PASS_PATTERN, .pattern = { 1, 2, 3 }, .len = 3 };
+    unsigned char buf[100];
+    pattern_expand(&g, 7, buf, sizeof(buf));
+    for (size_t i = 0; i < sizeof(buf); ++i) CHECK(buf[i] == (7 + i) % 3 + 1);
+}
+
+/* log-linear buckets: exact below HIST_SUB, within 1/(2 HIST_SUB) of the value above */
+static void test_hist_buckets(void) {
+    for (uint64_t v = 0; v < HIST_SUB; ++v) CHECK(hist_index(v) == v && hist_value(hist_index(v)) == (double)v);
+    unsigned prev = 0;
+    for (uint64_t v = 1; v < UINT64_MAX / 2; v = v < 4096 ? v + 1 : v + v / 3 + 1) {
+        unsigned i = hist_index(v);
+        CHECK(i < HIST_BUCKETS);
+        CHECK(i >= prev);
+        prev = i;
+        double mid = hist_value(i), err = mid > (double)v ? mid - (double)v : (double)v - mid;
+        CHECK(err <= (double)v / (2 * HIST_SUB));
+    }
+    CHECK(hist_index(UINT64_MAX) < HIST_BUCKETS);
+
+    /* 1..1000 us: percentiles land within the bucket error, and never above the max */
+    static struct hist h;
+    for (uint64_t us = 1; us <= 1000; ++us) {
+        uint64_t v = us * 1000;
+        h.count++;
+        h.sum += (double)v;
+        if (v > h.max) h.max = v;
+        h.b[hist_index(v)]++;
+    }
+    double p50 = hist_pct(&h, 0.50), p99 = hist_pct(&h, 0.99), top = hist_pct(&h, 1.0);
+    CHECK(p50 > 500e3 * (1 - 1.0 / HIST_SUB) && p50 < 500e3 * (1 + 1.0 / HIST_SUB));
+    CHECK(p99 > 990e3 * (1 - 1.0 / HIST_SUB) && p99 <= 1000e3);
+    CHECK(top == 1000e3);
+}
+
+static void journal_reset(void) {
+    if (journal.fd >= 0) close(journal.fd);
+    free(journal.recs);
+    journal.fd = -1;
+    journal.recs = NULL;
+    journal.nrecs = 0;
+}
+
+/* a journal with superseded, finished and unreadable lines loads as each file's last checkpoint */
+static void test_journal_roundtrip(void) {
+    char path[] = "/tmp/shredder-unit-XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    static const char lines[] =
+        "C 1 10 4096 100.000000005 0.000000000 1 0\n"
+        "C 2 20 8192 200.000000000 300.000000007 1 4096\n"
+        "garbage\n"
+        "C 1 10 4096 100.000000005 0.000000000 2 1024\n"
+        "C 3 30 1 0.000000000 0.000000000 1 0\n"
+        "D 3 30\n"
+        "C 1 5 4096 0.000000000 0.000000000 3 0\n";
+    CHECK(write(fd, lines, sizeof(lines) - 1) == (ssize_t)sizeof(lines) - 1);
+    close(fd);
+
+    CHECK(journal_open(path, 1 << 20) == 0);
+    CHECK(journal.nrecs == 3);
+    const struct journal_rec *r = journal_find(1, 10);
+    CHECK(r && r->pass == 2 && r->off == 1024 && r->id.size == 4096 && r->id.mtime.tv_nsec == 5);
+    r = journal_find(2, 20);
+    CHECK(r && r->pass == 1 && r->off == 4096 && r->id.btime.tv_sec == 300 && r->id.btime.tv_nsec == 7);
+    CHECK(journal_find(3, 30) == NULL);
+    CHECK(journal_find(1, 5) && journal_find(1, 5)->pass == 3);
+    CHECK(journal_find(2, 10) == NULL);
+
+    /* identity: size must match, then the birth time if both have one, else the mtime */
+    struct journal_rec got;
+    struct journal_id id = { .dev = 2, .ino = 20, .size = 8192, .btime = { 300, 7 } };
+    CHECK(journal_lookup(&id, &got) && got.off == 4096);
+    id.btime.tv_nsec = 8;
+    CHECK(!journal_lookup(&id, &got));
+    id = (struct journal_id){ .dev = 1, .ino = 10, .size = 4096, .mtime = { 100, 5 } };
+    CHECK(journal_lookup(&id, &got) && got.pass == 2);
+    id.size = 4095;
+    CHECK(!journal_lookup(&id, &got));
+
+    /* the file was rewritten compacted; what is appended now wins on the next load */
+    struct journal_rec next = *journal_find(2, 20);
+    next.pass = 3;
+    next.off = 0;
+    char line[256];
+    int n = journal_format(line, sizeof(line), &next);
+    journal_append(line, n, true, false);
+    journal_append("D 1 10\n", 7, true, false);
+    journal_reset();
+
+    CHECK(journal_open(path, 1 << 20) == 0);
+    CHECK(journal.nrecs == 2);
+    CHECK(journal_find(1, 10) == NULL);
+    r = journal_find(2, 20);
+    CHECK(r && r->pass == 3 && r->off == 0);
+    journal_reset();
+
+    FILE *in = fopen(path, "r");
+    size_t count = 0;
+    while (in && fgets(line, sizeof(line), in)) count++;
+    if (in) fclose(in);
+    CHECK(count == 2);
+    unlink(path);
+}
+
+/* --verify: the comparison finds the first wrong byte of a random or zero pass, from any start */
+static void test_verify_extents(void) {
+    char path[] = "/tmp/shredder-unit-XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    unlink(path);
+    enum { SIZE = 300000 };
+    static unsigned char data[SIZE];
+    struct keystream ks;
+    CHECK(keystream_seed(&ks) == 0);
+    keystream_fill(&ks, 0, data, SIZE);
+    CHECK(pwrite(fd, data, SIZE, 0) == SIZE);
+
+    struct extent ext[2] = { { 0, 100000 }, { 150000, SIZE } };
+    struct verify_job j = {
+        .fd = fd, .spec = { .kind = PASS_RANDOM }, .ks = ks, .ext = ext, .next = 2, .align = 1, .bufsize = 65536,
+        .path = path,
+    };
+    struct arena arena = { 0 };
+    off_t bad;
+    CHECK(verify_extents(&arena, &j, &bad) == 0);
+
+    /* a hole between the extents is not looked at */
+    CHECK(pwrite(fd, "x", 1, 120000) == 1);
+    CHECK(verify_extents(&arena, &j, &bad) == 0);
+    unsigned char flip = data[200001] ^ 1;
+    CHECK(pwrite(fd, &flip, 1, 200001) == 1);
+    CHECK(verify_extents(&arena, &j, &bad) == -1 && bad == 200001);
+    j.from = 250000; /* resumed past the damage */
+    CHECK(verify_extents(&arena, &j, &bad) == 0);
+
+    /* a file that shrank since it was written */
+    CHECK(ftruncate(fd, 250000) == 0);
+    CHECK(verify_extents(&arena, &j, &bad) == -1 && bad == -1 && errno == EIO);
+
+    memset(data, 0, SIZE);
+    CHECK(pwrite(fd, data, SIZE, 0) == SIZE);
+    j.spec.kind = PASS_ZERO;
+    j.from = 0;
+    CHECK(verify_extents(&arena, &j, &bad) == 0);
+    CHECK(pwrite(fd, "\1", 1, 299999) == 1);
+    CHECK(verify_extents(&arena, &j, &bad) == -1 && bad == 299999);
+    arena_release(&arena);
+    close(fd);
+}
+
+int main(void) {
+    test_chacha20_rfc8439();
+    test_keystream_offsets();
+    test_parse_scheme();
+    test_hist_buckets();
+    test_journal_roundtrip();
+    test_verify_extents();
+    if (failures) {
+        fprintf(stderr, "%d check%s failed\n", failures, failures == 1 ? "" : "s");
+        return 1;
+    }
+    printf("unit: all checks passed\n");
+    return 0;
+}